@@ -4,6 +4,7 @@
 #include <stddef.h>
 #include <math.h>
 #include "data_structures.h"
+#include "generic_sort.h"
 
 
 /*****************************************************
@@ -33,6 +34,34 @@ int* depth_first_search(const Graph* g);
  */
 int* breadth_first_search(const Graph* g);
 
+/* Whether a traversal marks a vertex as seen when it is visited, so that it may be pushed onto the
+ * stack or queue once for every edge into it that is seen before then, or when it is first pushed,
+ * so that it is pushed only once.
+ */
+enum TraversalMode { MARK_ON_VISIT, MARK_ON_PUSH };
+
+/* The same as depth_first_search and breadth_first_search, with the given traversal mode. */
+int* depth_first_search_mode(const Graph* g, enum TraversalMode mode);
+int* breadth_first_search_mode(const Graph* g, enum TraversalMode mode);
+
+/* Return a heap-allocated array of the number of edges on a shortest path from `source` to each
+ * vertex of the adjacency matrix, or -1 for vertices that cannot be reached from it.
+ */
+int* breadth_first_search_matrix(const GraphMatrix* m, size_t source);
+
+/* Run a breadth-first search from each of the `k` vertices in `sources`, and return a
+ * heap-allocated array of k*n distances, where entry i*n + v is the number of edges on a shortest
+ * path from sources[i] to v, or -1 if v cannot be reached from it.
+ */
+int* multi_source_bfs(const Graph* g, const size_t sources[], size_t k);
+
+/* The same as multi_source_bfs, but instead of the distances, store the number of vertices that
+ * each source reaches (including itself) in reached[i], and the sum of the distances to them in
+ * distance_sums[i].
+ */
+void multi_source_bfs_stats(const Graph* g, const size_t sources[], size_t k, size_t reached[],
+                            uint64_t distance_sums[]);
+
 
 /****************************************
  *   CHAPTER 4 - DECREASE and CONQUER   *
@@ -43,6 +72,32 @@ void insertion_sort(int array[], size_t n);
 
 /* Return a position of `datum` in the sorted array, or -1 if `datum` is not present. */
 long long binary_search(int array[], size_t n, int datum);
+/* Return the first position of `datum` in the sorted array, or -1 if `datum` is not present. On
+ * an array without duplicates, this is the same position that binary_search returns.
+ */
+long long interpolation_search(int array[], size_t n, int datum);
+
+
+/* Rearrange `array` so that array[k] is the element that would be in that position if the array
+ * were sorted, every element before it is no larger and every element after it is no smaller.
+ */
+void nth_element(int array[], size_t n, size_t k);
+
+/* Return the k'th smallest element of the array, starting from 0. */
+int quickselect(int array[], size_t n, size_t k);
+
+/* Rearrange `array` so that its first `k` elements are its k smallest elements in ascending
+ * order.
+ */
+void partial_sort(int array[], size_t n, size_t k);
+
+/* Collect the k smallest elements of a stream of unknown length. top_k_result writes the smallest
+ * elements pushed so far to `out` in ascending order and returns how many it wrote.
+ */
+TopK* top_k_new(size_t k);
+void top_k_free(TopK*);
+void top_k_push(TopK*, int);
+size_t top_k_result(const TopK*, int out[]);
 
 
 /* Return an ordering of a directed acyclic graph so that all edges point forwards along the
@@ -51,6 +106,28 @@ long long binary_search(int array[], size_t n, int datum);
  */
 int* topological_sort(const Graph* g);
 
+/* Maintain a topological order of a directed acyclic graph of `n` vertices as edges are added.
+ * topological_order_add_edge returns false, without adding the edge, if it would create a cycle.
+ * t->order[v] is the position of vertex v in the order, and t->vertex_at[i] is the vertex at
+ * position i.
+ */
+TopologicalOrder* topological_order_new(size_t n);
+void topological_order_free(TopologicalOrder* t);
+bool topological_order_add_edge(TopologicalOrder* t, size_t from, size_t to);
+
+/* Return a malloc'd array of the strongly connected component of each vertex of a directed graph,
+ * and store the number of components in `num_components`. The components are numbered from 0 in
+ * topological order, so every edge between two components goes from a lower number to a higher
+ * one.
+ */
+int* strongly_connected_components(const Graph* g, size_t* num_components);
+
+/* Return the condensation of a directed graph: the acyclic graph of its `num_components` strongly
+ * connected components, as numbered by strongly_connected_components, with an edge between two
+ * components if there is an edge between any of their vertices.
+ */
+Graph* condensation(const Graph* g, const int components[], size_t num_components);
+
 
 /**************************************
  *   CHAPTER 5 - DIVIDE and CONQUER   *
@@ -59,17 +136,46 @@ int* topological_sort(const Graph* g);
 /* Sort the elements of `array` in ascending order. */
 void merge_sort(int array[], size_t n);
 void merge(int left[], size_t left_len, int right[], size_t right_len, int target[]);
+void merge_branchless(int left[], size_t left_len, int right[], size_t right_len, int target[]);
+
+/* Sort the elements of `array` in ascending order, stably and in O(n) time if it is already sorted
+ * or made of a few long runs.
+ */
+void timsort(int array[], size_t n);
+
+/* Sort the elements of `array` in ascending order, stably and with O(1) extra memory. The _buffer
+ * variant uses `buffer` (which may be empty) as scratch space instead of a fixed buffer on the
+ * stack.
+ */
+void merge_sort_in_place(int array[], size_t n);
+void merge_sort_in_place_buffer(int array[], size_t n, int buffer[], size_t buffer_len);
+
+/* Merge the `k` sorted arrays `runs[0...k-1]`, where runs[i] has length lens[i], into `target`. */
+void kway_merge(int* runs[], const size_t lens[], size_t k, int target[]);
+
+/* Merge `k` sorted streams, each read in blocks by calling `source(sources[i], buffer, capacity)`,
+ * and pass the output to `sink(sink_context, block, len)` in blocks of `block_len` elements. A
+ * source returns the number of elements it wrote to `buffer`, or 0 at the end of its stream.
+ */
+typedef size_t kway_source_f(void* context, int buffer[], size_t capacity);
+typedef void kway_sink_f(void* context, const int block[], size_t len);
+void kway_merge_stream(kway_source_f* source, void* sources[], size_t k, kway_sink_f* sink,
+                       void* sink_context, size_t block_len);
 
 /* Sort the elements of `array` in ascending order. */
 void quicksort(int array[], size_t n);
 void quicksort_helper(int array[], size_t start, size_t end);
 size_t partition(int array[], size_t start, size_t end);
 
-/* Given the two lists of the same set of unique points, one in ascending order of the x-coordinate
- * and the other in ascending order of the y-coordinate, return the distance between the two closest
+/* Given the two lists of the same set of points, one in ascending order of the x-coordinate and
+ * the other in ascending order of the y-coordinate, return the distance between the two closest
  * points.
  */
 double closest_pair(Point sorted_by_x[], Point sorted_by_y[], size_t n);
+/* Return the distance between the two closest of the `n` points, which may be in any order, using
+ * up to `num_threads` threads.
+ */
+double closest_pair_parallel(const Point points[], size_t n, int num_threads);
 
 
 /*****************************************
@@ -82,6 +188,165 @@ void heapify(int array[], size_t n);
 void heap_delete(int heap[], size_t n);
 void fix_heap(size_t index, int heap[], size_t n);
 
+/* Orderings of the vertices of a graph for vertex_ordering: breadth-first search order, descending
+ * out-degree, and reverse Cuthill-McKee.
+ */
+enum VertexOrdering { ORDER_BFS, ORDER_DEGREE, ORDER_RCM };
+/* Return a malloc'd permutation of the vertices of `g`, where order[i] is the vertex to put at
+ * position i, that improves the locality of traversals once applied with graph_permute.
+ */
+size_t* vertex_ordering(const Graph* g, enum VertexOrdering kind);
+/* Return a copy of `g` with vertex order[i] of `g` relabeled as vertex i, and with its adjacency
+ * lists stored contiguously in that order.
+ */
+Graph* graph_permute(const Graph* g, const size_t order[]);
+
+
+/*********************************************
+ *   CHAPTER 7 - SPACE and TIME TRADE-OFFS   *
+ *********************************************/
+
+/* Sort the elements of `array` in ascending order. */
+void radix_sort_u64(uint64_t array[], size_t n);
+/* Radix sort `array` on bytes [first_byte, last_byte) of its elements only (byte 0 is the least
+ * significant). The sort is stable.
+ */
+void radix_sort_u64_bytes(uint64_t array[], size_t n, int first_byte, int last_byte);
+
+/* Set perm[i] to the index of the i'th smallest key, so that keys[perm[0]], keys[perm[1]], ... is
+ * in ascending order. `n` must be less than 2^32. argsort may put equal keys in any order, while
+ * argsort_stable and argsort_packed keep them in order of their index.
+ */
+void argsort(const int* keys, size_t n, uint32_t* perm);
+void argsort_stable(const int* keys, size_t n, uint32_t* perm);
+void argsort_packed(const int* keys, size_t n, uint32_t* perm);
+
+/* Pack a key and its index into a 64-bit integer, so that comparing the packed integers as
+ * unsigned numbers compares by key and breaks ties by index. Arrays of packed integers can be
+ * sorted with any integer sort (e.g. radix_sort_u64 or u64_quicksort) to get an argsort.
+ */
+#define PACK_KEY_INDEX(key, index) \
+    (((uint64_t)((uint32_t)(key) ^ 0x80000000u) << 32) | (uint32_t)(index))
+#define UNPACK_INDEX(packed) ((uint32_t)(packed))
+
+/* Set dst[i] = src[perm[i]] for arrays of `elem_size`-byte elements. */
+void gather(const void* src, size_t elem_size, const uint32_t* perm, size_t n, void* dst);
+
+/* Maintain the closest pair of a changing set of points. closest_pair_set_insert returns an id for
+ * the new point, which is passed to closest_pair_set_remove to remove it again.
+ * closest_pair_set_query returns the distance between the two closest points (or INFINITY if there
+ * are fewer than two) and stores their ids in `a` and `b` unless they are NULL.
+ */
+ClosestPairSet* closest_pair_set_new(void);
+void closest_pair_set_free(ClosestPairSet*);
+size_t closest_pair_set_insert(ClosestPairSet*, Point);
+void closest_pair_set_remove(ClosestPairSet*, size_t id);
+double closest_pair_set_query(const ClosestPairSet*, size_t* a, size_t* b);
+
+/* Build an index over the `n` sorted `keys`, which must not change or be freed while the index is
+ * in use. Each lookup searches a window of about 2 * max_error + 1 keys, and a larger max_error
+ * makes the index smaller.
+ */
+LearnedIndex* learned_index_new(const int keys[], size_t n, size_t max_error);
+void learned_index_free(LearnedIndex*);
+/* Return the first position of `datum` in the keys, or -1 if `datum` is not present. On keys
+ * without duplicates, this is the same position that binary_search returns.
+ */
+long long learned_index_search(const LearnedIndex*, int datum);
+
+
+/***************************************
+ *   CHAPTER 8 - DYNAMIC PROGRAMMING   *
+ ***************************************/
+
+/* Replace the adjacency matrix with its transitive closure, which has an edge from i to j if and
+ * only if the original graph has a path of one or more edges from i to j.
+ */
+void transitive_closure(GraphMatrix* m);
+
+
+/************************************
+ *   CHAPTER 9 - GREEDY TECHNIQUE   *
+ ***********************************/
+
+/* Construct the partition of 0 through n-1 into n singleton sets. */
+DisjointSets* disjoint_sets_new(size_t n);
+void disjoint_sets_free(DisjointSets*);
+/* Return the representative (smallest element) of the set containing `x`. */
+size_t disjoint_sets_find(DisjointSets* s, size_t x);
+/* Merge the sets containing `x` and `y`, and return whether they were different sets. Both of
+ * these functions may be called by several threads at once.
+ */
+bool disjoint_sets_union(DisjointSets* s, size_t x, size_t y);
+
+/* Return a malloc'd array of the connected component of each vertex of `g`, numbered from 0 in
+ * order of the smallest vertex of each component, and store the number of components in
+ * `num_components`. The edges are treated as undirected. The edges are divided among up to
+ * `num_threads` threads.
+ */
+int* connected_components(const Graph* g, size_t* num_components, int num_threads);
+
+
+/******************************************
+ *   TYPE-GENERIC SORTING and SEARCHING   *
+ ******************************************/
+
+/* Instantiations of the algorithms in generic_sort.h for common element types. See that file for
+ * the full list of functions that each one declares.
+ */
+SORTING_DECLARE(i32, int32_t)
+SORTING_DECLARE(i64, int64_t)
+SORTING_DECLARE(u64, uint64_t)
+/* Floating-point numbers are sorted with NaNs last. */
+SORTING_DECLARE(f32, float)
+SORTING_DECLARE(f64, double)
+/* KeyValue records are sorted by key. */
+SORTING_DECLARE(kv, KeyValue)
+
+
+/************************
+ *   SORTING NETWORKS   *
+ ************************/
+
+/* The largest array that the sorting networks can sort. */
+#define SMALL_SORT_MAX 64
+/* Quicksort and merge sort hand subarrays of this size or smaller to small_sort, instead of
+ * recursing all the way down to single elements.
+ */
+#define SMALL_SORT_THRESHOLD 32
+
+/* Sort an array of at most SMALL_SORT_MAX elements in ascending order, with a SIMD sorting network
+ * if the CPU supports one and a branchless scalar sorting network otherwise.
+ */
+void small_sort(int array[], size_t n);
+void sorting_network_scalar(int array[], size_t n);
+/* Only call this if have_avx2() returns true. */
+void sorting_network_avx2(int array[], size_t n);
+/* The same as merge, using a SIMD bitonic merge network. Only call this if have_avx2() returns
+ * true.
+ */
+void merge_avx2(int left[], size_t left_len, int right[], size_t right_len, int target[]);
+bool have_avx2(void);
+
+
+/************************
+ *   EXTERNAL SORTING   *
+ ************************/
+
+typedef struct {
+    /* The most memory, in bytes, that the sort may use for buffers. 0 means 256 MiB. */
+    size_t memory_budget;
+    /* The directory for temporary files. NULL means $TMPDIR, or /tmp if that is not set. */
+    const char* temp_dir;
+} ExternalSortOptions;
+
+/* Sort a file of native-endian signed integers of `record_size` bytes (4 or 8) that may be larger
+ * than memory, and write the result to `output_path`. `options` may be NULL to use the defaults.
+ * Return 0 on success or -1 with errno set on failure.
+ */
+int external_sort(const char* input_path, const char* output_path, size_t record_size,
+                  const ExternalSortOptions* options);
+
 
 /*************************
  *   UTILITY FUNCTIONS   *
@@ -107,6 +372,11 @@ void* safe_malloc(size_t);
 void* safe_calloc(size_t, size_t);
 void* safe_realloc(void*, size_t);
 
+/* Run `task` on each of the `num_tasks` elements of the array `tasks` (each `size` bytes long), on
+ * one thread per element, and return once all of them have finished.
+ */
+void run_in_parallel(void* (*task)(void*), void* tasks, size_t size, int num_tasks);
+
 /* Run the sorting test suite against an arbitrary sorting function. */
 typedef void sorting_f(int*, size_t);
 int test_sorting_f(sorting_f f);
@@ -130,3 +400,9 @@ int ch03_tests(void);
 int ch04_tests(void);
 int ch05_tests(void);
 int ch06_tests(void);
+int ch07_tests(void);
+int ch08_tests(void);
+int ch09_tests(void);
+int generic_sort_tests(void);
+int external_sort_tests(void);
+int sorting_network_tests(void);
@@ -0,0 +1,1204 @@
+/* A benchmark driver for the algorithms in this repository.
+ *
+ * Usage: ./benchmark [--perf] [--max-n N] [FILTER]
+ *
+ * Every algorithm is run on a range of input sizes (1000, 10000, ... up to N, and N itself) and
+ * input distributions, and the wall-clock time of each run is reported. With --perf, the hardware
+ * performance counters (cycles, instructions, cache misses, branch mispredictions and data TLB
+ * misses) of each run are read with Linux's perf_event_open and reported alongside the time.
+ * Counters that never got onto the PMU during a run are shown as "-", and counts from a run that
+ * only had the PMU part of the time are scaled up and marked "(scaled)". The counters only count
+ * the calling thread, so they are also shown as "-" for runs on more than one thread. If FILTER is
+ * given, only algorithms whose names contain it are run.
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "algorithms.h"
+
+
+/****************************
+ *   PERFORMANCE COUNTERS   *
+ ****************************/
+
+enum { CYCLES, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES, DTLB_MISSES, NUM_COUNTERS };
+
+static const char* counter_names[NUM_COUNTERS] = {
+    "cycles", "instructions", "cache-misses", "branch-misses", "dTLB-misses"
+};
+
+typedef struct {
+    /* The counters are opened as a single group led by the cycle counter, so that they are all
+     * scheduled onto the PMU together and can be read with one system call. A file descriptor of -1
+     * means that the counter is not supported on this machine.
+     */
+    int fds[NUM_COUNTERS];
+    int leader;
+} PerfCounters;
+
+typedef struct {
+    double seconds;
+    /* -1 if the counter was not available, or was never scheduled onto the PMU during the run. */
+    long long counts[NUM_COUNTERS];
+    /* Whether the counters only ran for part of the run (e.g. because other perf users or the NMI
+     * watchdog took some of the PMU), in which case the counts are scaled up to the whole run.
+     */
+    bool scaled;
+} Sample;
+
+
+static int perf_event_open(struct perf_event_attr* attr, int group_fd) {
+    /* Count the calling thread on any CPU. */
+    return (int)syscall(__NR_perf_event_open, attr, 0, -1, group_fd, 0);
+}
+
+
+static void perf_counters_open(PerfCounters* pc) {
+    static const struct { uint32_t type; uint64_t config; } events[NUM_COUNTERS] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB
+                              | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                              | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    };
+    pc->leader = -1;
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof attr);
+        attr.size = sizeof attr;
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = pc->leader == -1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED
+                           | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        pc->fds[i] = perf_event_open(&attr, pc->leader);
+        if (pc->fds[i] != -1 && pc->leader == -1) {
+            pc->leader = pc->fds[i];
+        }
+    }
+}
+
+
+static void perf_counters_close(PerfCounters* pc) {
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        if (pc->fds[i] != -1) {
+            close(pc->fds[i]);
+        }
+    }
+}
+
+
+static void perf_counters_start(const PerfCounters* pc) {
+    if (pc->leader == -1) return;
+    ioctl(pc->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(pc->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+
+static void perf_counters_stop(const PerfCounters* pc, Sample* sample) {
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        sample->counts[i] = -1;
+    }
+    sample->scaled = false;
+    if (pc->leader == -1) return;
+    ioctl(pc->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    /* With this read_format, the layout is the number of counters, the time the group was enabled
+     * and the time it was actually running, followed by a (value, id) pair for each counter.
+     */
+    uint64_t buffer[3 + 2*NUM_COUNTERS];
+    if (read(pc->leader, buffer, sizeof buffer) <= 0) return;
+    uint64_t time_enabled = buffer[1], time_running = buffer[2];
+    if (time_running == 0) return;
+    double scale = 1;
+    if (time_running < time_enabled) {
+        scale = (double)time_enabled / time_running;
+        sample->scaled = true;
+    }
+    uint64_t ids[NUM_COUNTERS];
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        if (pc->fds[i] == -1 || ioctl(pc->fds[i], PERF_EVENT_IOC_ID, &ids[i]) == -1) {
+            ids[i] = UINT64_MAX;
+        }
+    }
+    for (uint64_t j = 0; j < buffer[0] && j < NUM_COUNTERS; j++) {
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            if (ids[i] == buffer[4 + 2*j]) {
+                sample->counts[i] = (long long)((double)buffer[3 + 2*j] * scale);
+            }
+        }
+    }
+}
+
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/************************
+ *   INPUT GENERATION   *
+ ************************/
+
+/* xorshift64*, so that the inputs are the same on every platform. */
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+
+enum Distribution { RANDOM, SORTED, REVERSED, FEW_UNIQUE, NEARLY_SORTED, NUM_DISTRIBUTIONS };
+
+static const char* distribution_names[NUM_DISTRIBUTIONS] = {
+    "random", "sorted", "reversed", "few-unique", "nearly-sorted"
+};
+
+static void fill_array(int array[], size_t n, enum Distribution d) {
+    for (size_t i = 0; i < n; i++) {
+        switch (d) {
+            case RANDOM: array[i] = (int)(rng_next() >> 33); break;
+            case SORTED: array[i] = (int)i; break;
+            case REVERSED: array[i] = (int)(n - i); break;
+            case FEW_UNIQUE: array[i] = (int)(rng_next() % 16); break;
+            /* Sorted, except that 1% of the elements are random, like a log that was sorted and
+             * then had a few updates.
+             */
+            case NEARLY_SORTED:
+                array[i] = rng_next() % 100 == 0 ? (int)(rng_next() % n) : (int)i;
+                break;
+            default: break;
+        }
+    }
+}
+
+
+/* An undirected random recursive tree: every vertex after the first is connected to a uniformly
+ * random earlier vertex.
+ */
+static Graph* random_tree(size_t n) {
+    Graph* g = graph_new(n);
+    for (size_t i = 1; i < n; i++) {
+        size_t parent = rng_next() % i;
+        graph_add_edge_index(g, i, parent);
+        graph_add_edge_index(g, parent, i);
+    }
+    return g;
+}
+
+
+/* A directed graph where every vertex has 8 edges to uniformly random vertices. */
+static Graph* random_deg8(size_t n) {
+    Graph* g = graph_new(n);
+    for (size_t i = 0; i < n; i++) {
+        for (int j = 0; j < 8; j++) {
+            graph_add_edge_index(g, i, rng_next() % n);
+        }
+    }
+    return g;
+}
+
+
+/* An undirected square grid of about `n` vertices, each connected to its four neighbors. */
+static Graph* mesh(size_t n) {
+    size_t side = 1;
+    while ((side + 1) * (side + 1) <= n) {
+        side++;
+    }
+    Graph* g = graph_new(side * side);
+    for (size_t r = 0; r < side; r++) {
+        for (size_t c = 0; c < side; c++) {
+            size_t v = r * side + c;
+            if (c + 1 < side) {
+                graph_add_edge_index(g, v, v + 1);
+                graph_add_edge_index(g, v + 1, v);
+            }
+            if (r + 1 < side) {
+                graph_add_edge_index(g, v, v + side);
+                graph_add_edge_index(g, v + side, v);
+            }
+        }
+    }
+    return g;
+}
+
+
+/* A uniformly random permutation of 0, ..., n-1, for giving generated graphs arbitrary labels. */
+static size_t* random_permutation(size_t n) {
+    size_t* labels = safe_malloc((n > 0 ? n : 1) * sizeof *labels);
+    for (size_t i = 0; i < n; i++) {
+        labels[i] = i;
+    }
+    for (size_t i = n; i > 1; i--) {
+        size_t j = rng_next() % i;
+        size_t t = labels[i-1];
+        labels[i-1] = labels[j];
+        labels[j] = t;
+    }
+    return labels;
+}
+
+
+/* An undirected power-law graph made by preferential attachment: every vertex after the first
+ * is connected to 4 earlier vertices picked with probability proportional to their degree, as in
+ * social and web graphs. The vertices are labeled in random order, as they would be in a real
+ * data set, rather than in the order they were added.
+ */
+static Graph* power_law(size_t n) {
+    Graph* g = graph_new(n);
+    size_t* labels = random_permutation(n);
+    /* Both ends of every edge so far, so that a uniform pick is proportional to degree. */
+    size_t* ends = safe_malloc((8 * n > 0 ? 8 * n : 1) * sizeof *ends);
+    size_t num_ends = 0;
+    for (size_t i = 1; i < n; i++) {
+        size_t added = num_ends;
+        for (int j = 0; j < 4; j++) {
+            size_t target = added > 0 ? ends[rng_next() % added] : 0;
+            graph_add_edge_index(g, labels[i], labels[target]);
+            graph_add_edge_index(g, labels[target], labels[i]);
+            ends[num_ends++] = i;
+            ends[num_ends++] = target;
+        }
+    }
+    free(ends);
+    free(labels);
+    return g;
+}
+
+
+/* The same grid as `mesh`, with the vertices labeled in random order. */
+static Graph* shuffled_mesh(size_t n) {
+    Graph* grid = mesh(n);
+    size_t* labels = random_permutation(grid->n);
+    Graph* g = graph_new(grid->n);
+    for (size_t v = 0; v < grid->n; v++) {
+        for (VertexList* p = grid->vertices[v].neighbors; p != NULL; p = p->next) {
+            graph_add_edge_index(g, labels[v], labels[p->v - grid->vertices]);
+        }
+    }
+    free(labels);
+    graph_free(grid);
+    return g;
+}
+
+
+static const struct {
+    const char* name;
+    Graph* (*generate)(size_t);
+} graph_kinds[] = {
+    { "random-tree", random_tree },
+    { "random-deg8", random_deg8 },
+    { "mesh", mesh },
+};
+
+
+/*****************
+ *   REPORTING   *
+ *****************/
+
+static bool use_perf = false;
+static PerfCounters counters;
+
+
+static void print_header(void) {
+    printf("%-24s %-14s %10s %12s", "algorithm", "input", "n", "time (ms)");
+    if (use_perf) {
+        printf(" %8s", "IPC");
+        for (int i = CACHE_MISSES; i < NUM_COUNTERS; i++) {
+            printf(" %14s", counter_names[i]);
+        }
+    }
+    printf("\n");
+}
+
+
+static void print_sample(const char* algorithm, const char* input, size_t n, const Sample* s) {
+    printf("%-24s %-14s %10zu %12.3f", algorithm, input, n, s->seconds * 1e3);
+    if (use_perf) {
+        if (s->counts[CYCLES] > 0 && s->counts[INSTRUCTIONS] >= 0) {
+            printf(" %8.2f", (double)s->counts[INSTRUCTIONS] / s->counts[CYCLES]);
+        } else {
+            printf(" %8s", "-");
+        }
+        for (int i = CACHE_MISSES; i < NUM_COUNTERS; i++) {
+            if (s->counts[i] >= 0) {
+                printf(" %14lld", s->counts[i]);
+            } else {
+                printf(" %14s", "-");
+            }
+        }
+        if (s->scaled) {
+            printf(" (scaled)");
+        }
+    }
+    printf("\n");
+}
+
+
+static void begin_sample(Sample* s) {
+    if (use_perf) perf_counters_start(&counters);
+    s->seconds = now();
+}
+
+
+static void end_sample(Sample* s) {
+    s->seconds = now() - s->seconds;
+    if (use_perf) {
+        perf_counters_stop(&counters, s);
+    } else {
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            s->counts[i] = -1;
+        }
+        s->scaled = false;
+    }
+}
+
+
+/* End the sample of a run on `num_threads` threads. The counters are opened for the calling thread
+ * only, so for a run on more than one thread they would miss most of the work, and are dropped.
+ */
+static void end_threaded_sample(Sample* s, int num_threads) {
+    end_sample(s);
+    if (num_threads > 1) {
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            s->counts[i] = -1;
+        }
+        s->scaled = false;
+    }
+}
+
+
+/******************
+ *   BENCHMARKS   *
+ ******************/
+
+/* Quicksort's first-element pivot makes it quadratic (in both time and recursion depth) on sorted,
+ * reversed and nearly sorted input, so those runs are capped at this size.
+ */
+#define QUADRATIC_CAP 20000
+
+static int compare_ints(const void* a, const void* b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+/* The C library's sort, as a baseline for the type-generic sorts. */
+static void libc_qsort(int array[], size_t n) {
+    qsort(array, n, sizeof *array, compare_ints);
+}
+
+static const struct {
+    const char* name;
+    sorting_f* f;
+    bool quadratic_on_sorted;
+} sorts[] = {
+    { "quicksort", quicksort, true },
+    { "heapsort", heapsort, false },
+    { "merge_sort", merge_sort, false },
+    { "timsort", timsort, false },
+    { "merge_sort_in_place", merge_sort_in_place, false },
+    { "i32_quicksort", i32_quicksort, false },
+    { "i32_merge_sort", i32_merge_sort, false },
+    { "qsort", libc_qsort, false },
+};
+
+
+static void bench_sorts(const size_t sizes[], size_t num_sizes, const char* filter) {
+    for (size_t a = 0; a < sizeof sorts / sizeof sorts[0]; a++) {
+        if (filter != NULL && strstr(sorts[a].name, filter) == NULL) continue;
+        for (int d = 0; d < NUM_DISTRIBUTIONS; d++) {
+            for (size_t k = 0; k < num_sizes; k++) {
+                size_t n = sizes[k];
+                if (sorts[a].quadratic_on_sorted && d != RANDOM && d != FEW_UNIQUE
+                        && n > QUADRATIC_CAP) {
+                    continue;
+                }
+                int* data = safe_malloc(n * sizeof *data);
+                fill_array(data, n, d);
+                Sample s;
+                begin_sample(&s);
+                sorts[a].f(data, n);
+                end_sample(&s);
+                if (!is_sorted(data, n)) {
+                    printf("*  %s did not sort its input\n", sorts[a].name);
+                }
+                print_sample(sorts[a].name, distribution_names[d], n, &s);
+                free(data);
+            }
+        }
+    }
+}
+
+
+/* Selection of the median and of the 100 smallest elements, to compare against sorting. */
+#define SELECTION_K 100
+
+static void bench_selection(const size_t sizes[], size_t num_sizes, const char* filter) {
+    const char* names[] = { "nth_element", "partial_sort", "top_k" };
+    for (int a = 0; a < 3; a++) {
+        if (filter != NULL && strstr(names[a], filter) == NULL) continue;
+        for (int d = 0; d < NUM_DISTRIBUTIONS; d++) {
+            for (size_t k = 0; k < num_sizes; k++) {
+                size_t n = sizes[k];
+                int* data = safe_malloc(n * sizeof *data);
+                fill_array(data, n, d);
+                int out[SELECTION_K];
+                Sample s;
+                begin_sample(&s);
+                if (a == 0) {
+                    nth_element(data, n, n / 2);
+                } else if (a == 1) {
+                    partial_sort(data, n, SELECTION_K);
+                } else {
+                    TopK* top = top_k_new(SELECTION_K);
+                    for (size_t i = 0; i < n; i++) {
+                        top_k_push(top, data[i]);
+                    }
+                    top_k_result(top, out);
+                    top_k_free(top);
+                }
+                end_sample(&s);
+                print_sample(names[a], distribution_names[d], n, &s);
+                free(data);
+            }
+        }
+    }
+}
+
+
+static const struct {
+    const char* name;
+    void (*f)(const int*, size_t, uint32_t*);
+} argsorts[] = {
+    { "argsort", argsort },
+    { "argsort_stable", argsort_stable },
+    { "argsort_packed", argsort_packed },
+};
+
+
+static void bench_argsorts(const size_t sizes[], size_t num_sizes, const char* filter) {
+    for (size_t a = 0; a < sizeof argsorts / sizeof argsorts[0]; a++) {
+        if (filter != NULL && strstr(argsorts[a].name, filter) == NULL) continue;
+        for (int d = 0; d < NUM_DISTRIBUTIONS; d++) {
+            for (size_t k = 0; k < num_sizes; k++) {
+                size_t n = sizes[k];
+                int* keys = safe_malloc(n * sizeof *keys);
+                uint32_t* perm = safe_malloc(n * sizeof *perm);
+                fill_array(keys, n, d);
+                Sample s;
+                begin_sample(&s);
+                argsorts[a].f(keys, n, perm);
+                end_sample(&s);
+                print_sample(argsorts[a].name, distribution_names[d], n, &s);
+                free(keys);
+                free(perm);
+            }
+        }
+    }
+}
+
+
+/* The original merge loop, which branches on every comparison, as a baseline. */
+static void merge_branchy(int left[], size_t left_len, int right[], size_t right_len,
+                          int target[]) {
+    size_t i = 0, j = 0;
+    while (i < left_len && j < right_len) {
+        if (left[i] <= right[j]) {
+            target[i+j] = left[i];
+            i++;
+        } else {
+            target[i+j] = right[j];
+            j++;
+        }
+    }
+    while (i < left_len) {
+        target[i+j] = left[i];
+        i++;
+    }
+    while (j < right_len) {
+        target[i+j] = right[j];
+        j++;
+    }
+}
+
+static const struct {
+    const char* name;
+    void (*f)(int*, size_t, int*, size_t, int*);
+} merges[] = {
+    { "merge_branchy", merge_branchy },
+    { "merge_branchless", merge_branchless },
+    { "merge_avx2", merge_avx2 },
+};
+
+
+/* Merge two sorted halves of n/2 elements each. */
+static void bench_merges(const size_t sizes[], size_t num_sizes, const char* filter) {
+    for (size_t a = 0; a < sizeof merges / sizeof merges[0]; a++) {
+        if (filter != NULL && strstr(merges[a].name, filter) == NULL) continue;
+        if (merges[a].f == merge_avx2 && !have_avx2()) continue;
+        for (int d = 0; d < NUM_DISTRIBUTIONS; d++) {
+            for (size_t k = 0; k < num_sizes; k++) {
+                size_t n = sizes[k];
+                int* data = safe_malloc(n * sizeof *data);
+                int* target = safe_malloc(n * sizeof *target);
+                fill_array(data, n, d);
+                i32_quicksort(data, n/2);
+                i32_quicksort(data + n/2, n - n/2);
+                Sample s;
+                begin_sample(&s);
+                merges[a].f(data, n/2, data + n/2, n - n/2, target);
+                end_sample(&s);
+                if (!is_sorted(target, n)) {
+                    printf("*  %s did not merge its input\n", merges[a].name);
+                }
+                print_sample(merges[a].name, distribution_names[d], n, &s);
+                free(data);
+                free(target);
+            }
+        }
+    }
+}
+
+
+#define NUM_QUERIES 1000000
+
+static void bench_searches(const size_t sizes[], size_t num_sizes, const char* filter) {
+    if (filter != NULL && strstr("binary_search", filter) == NULL) return;
+    int* queries = safe_malloc(NUM_QUERIES * sizeof *queries);
+    for (size_t k = 0; k < num_sizes; k++) {
+        size_t n = sizes[k];
+        /* Only the even numbers are in the array, so about half the queries are misses. */
+        int* data = safe_malloc(n * sizeof *data);
+        for (size_t i = 0; i < n; i++) {
+            data[i] = (int)(2*i);
+        }
+        const char* inputs[] = { "random", "sequential" };
+        for (int d = 0; d < 2; d++) {
+            for (size_t i = 0; i < NUM_QUERIES; i++) {
+                queries[i] = d == 0 ? (int)(rng_next() % (2*n)) : (int)((i * 2*n) / NUM_QUERIES);
+            }
+            long long found = 0;
+            Sample s;
+            begin_sample(&s);
+            for (size_t i = 0; i < NUM_QUERIES; i++) {
+                found += binary_search(data, n, queries[i]) != -1;
+            }
+            end_sample(&s);
+            if (found == 0) {
+                printf("*  binary_search found nothing\n");
+            }
+            print_sample("binary_search", inputs[d], n, &s);
+        }
+        free(data);
+    }
+    free(queries);
+}
+
+
+/* Sorted keys for bench_lookups. "smooth" keys have small random gaps, so a few lines fit them
+ * well, while "clustered" keys come in runs of 1024 close keys with large gaps between runs, which
+ * fool interpolation. Either way the keys stay well within the range of an int.
+ */
+static int* sorted_keys(size_t n, bool clustered) {
+    int* keys = safe_malloc(n * sizeof *keys);
+    int big_gap = (1 << 30) / (int)(n / 1024 + 1);
+    int key = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (clustered) {
+            key += i % 1024 == 1023 ? big_gap : 1 + (int)(rng_next() % 8);
+        } else {
+            key += 1 + (int)(rng_next() % 64);
+        }
+        keys[i] = key;
+    }
+    return keys;
+}
+
+
+static void bench_lookups(const size_t sizes[], size_t num_sizes, const char* filter) {
+    const char* names[] = { "binary_search", "interpolation_search", "learned_index/4",
+                            "learned_index/64" };
+    size_t error_bounds[] = { 0, 0, 4, 64 };
+    int* queries = safe_malloc(NUM_QUERIES * sizeof *queries);
+    for (int d = 0; d < 2; d++) {
+        const char* input = d == 0 ? "smooth" : "clustered";
+        for (size_t k = 0; k < num_sizes; k++) {
+            size_t n = sizes[k];
+            int* keys = sorted_keys(n, d == 1);
+            /* Every other query is a key in the array, and the rest are mostly misses. */
+            for (size_t i = 0; i < NUM_QUERIES; i++) {
+                queries[i] = keys[rng_next() % n] + (int)(i % 2);
+            }
+            long long expected = -1;
+            for (int a = 0; a < 4; a++) {
+                if (filter != NULL && strstr(names[a], filter) == NULL) continue;
+                LearnedIndex* index = a >= 2 ? learned_index_new(keys, n, error_bounds[a]) : NULL;
+                long long found = 0;
+                Sample s;
+                begin_sample(&s);
+                for (size_t i = 0; i < NUM_QUERIES; i++) {
+                    long long position = a == 0 ? binary_search(keys, n, queries[i])
+                                       : a == 1 ? interpolation_search(keys, n, queries[i])
+                                       : learned_index_search(index, queries[i]);
+                    found += position != -1;
+                }
+                end_sample(&s);
+                if (expected != -1 && found != expected) {
+                    printf("*  %s found %lld keys instead of %lld\n", names[a], found, expected);
+                }
+                expected = found;
+                print_sample(names[a], input, n, &s);
+                learned_index_free(index);
+            }
+            free(keys);
+        }
+    }
+    free(queries);
+}
+
+
+typedef int* traversal_f(const Graph*);
+
+static int* dfs_mark_on_push(const Graph* g) {
+    return depth_first_search_mode(g, MARK_ON_PUSH);
+}
+
+static int* bfs_mark_on_push(const Graph* g) {
+    return breadth_first_search_mode(g, MARK_ON_PUSH);
+}
+
+static int* scc_tarjan(const Graph* g) {
+    size_t num_components;
+    return strongly_connected_components(g, &num_components);
+}
+
+static const struct {
+    const char* name;
+    traversal_f* f;
+} traversals[] = {
+    { "depth_first_search", depth_first_search },
+    { "dfs_mark_on_push", dfs_mark_on_push },
+    { "breadth_first_search", breadth_first_search },
+    { "bfs_mark_on_push", bfs_mark_on_push },
+    { "scc_tarjan", scc_tarjan },
+};
+
+
+static void bench_traversals(const size_t sizes[], size_t num_sizes, const char* filter) {
+    for (size_t a = 0; a < sizeof traversals / sizeof traversals[0]; a++) {
+        if (filter != NULL && strstr(traversals[a].name, filter) == NULL) continue;
+        for (size_t kind = 0; kind < sizeof graph_kinds / sizeof graph_kinds[0]; kind++) {
+            for (size_t k = 0; k < num_sizes; k++) {
+                size_t n = sizes[k];
+                Graph* g = graph_kinds[kind].generate(n);
+                Sample s;
+                begin_sample(&s);
+                int* counts = traversals[a].f(g);
+                end_sample(&s);
+                print_sample(traversals[a].name, graph_kinds[kind].name, g->n, &s);
+                free(counts);
+                graph_free(g);
+            }
+        }
+    }
+}
+
+
+static const struct {
+    const char* name;
+    Graph* (*generate)(size_t);
+} unordered_graph_kinds[] = {
+    { "plaw", power_law },
+    { "rmesh", shuffled_mesh },
+};
+
+static const struct {
+    const char* name;
+    enum VertexOrdering kind;
+} vertex_orderings[] = {
+    { "bfs", ORDER_BFS },
+    { "degree", ORDER_DEGREE },
+    { "rcm", ORDER_RCM },
+};
+
+
+/* Run the mark-on-push traversals on a randomly labeled graph, on the same graph with its
+ * adjacency lists copied in the original order ("-copy"), and on the graph relabeled by each
+ * vertex ordering, along with the time taken to compute each ordering and apply it.
+ */
+static void bench_vertex_orderings(const size_t sizes[], size_t num_sizes, const char* filter) {
+    if (filter != NULL && strstr("vertex_ordering", filter) == NULL
+            && strstr(traversals[1].name, filter) == NULL
+            && strstr(traversals[3].name, filter) == NULL) {
+        return;
+    }
+    for (size_t kind = 0; kind < sizeof unordered_graph_kinds / sizeof unordered_graph_kinds[0];
+            kind++) {
+        for (size_t k = 0; k < num_sizes; k++) {
+            Graph* g = unordered_graph_kinds[kind].generate(sizes[k]);
+            size_t n = g->n;
+            for (size_t o = 0; o <= sizeof vertex_orderings / sizeof vertex_orderings[0] + 1; o++) {
+                char input[32];
+                const Graph* target = g;
+                Graph* permuted = NULL;
+                Sample s;
+                if (o == 0) {
+                    snprintf(input, sizeof input, "%s", unordered_graph_kinds[kind].name);
+                } else if (o == 1) {
+                    snprintf(input, sizeof input, "%s-copy", unordered_graph_kinds[kind].name);
+                    size_t* order = safe_malloc((n > 0 ? n : 1) * sizeof *order);
+                    for (size_t v = 0; v < n; v++) {
+                        order[v] = v;
+                    }
+                    target = permuted = graph_permute(g, order);
+                    free(order);
+                } else {
+                    snprintf(input, sizeof input, "%s-%s", unordered_graph_kinds[kind].name,
+                             vertex_orderings[o-2].name);
+                    bool selected = filter == NULL || strstr("vertex_ordering", filter) != NULL;
+                    if (selected) begin_sample(&s);
+                    size_t* order = vertex_ordering(g, vertex_orderings[o-2].kind);
+                    target = permuted = graph_permute(g, order);
+                    if (selected) {
+                        end_sample(&s);
+                        print_sample("vertex_ordering", input, n, &s);
+                    }
+                    free(order);
+                }
+                for (size_t a = 1; a <= 3; a += 2) {
+                    if (filter != NULL && strstr(traversals[a].name, filter) == NULL) continue;
+                    begin_sample(&s);
+                    int* counts = traversals[a].f(target);
+                    end_sample(&s);
+                    print_sample(traversals[a].name, input, n, &s);
+                    free(counts);
+                }
+                graph_free(permuted);
+            }
+            graph_free(g);
+        }
+    }
+}
+
+
+/* Number the connected components of an undirected graph by depth-first search from each unvisited
+ * vertex in turn, the serial baseline for connected_components.
+ */
+static int* dfs_components(const Graph* g) {
+    int* components = safe_malloc((g->n > 0 ? g->n : 1) * sizeof *components);
+    size_t* stack = safe_malloc((g->n > 0 ? g->n : 1) * sizeof *stack);
+    for (size_t v = 0; v < g->n; v++) {
+        components[v] = -1;
+    }
+    int count = 0;
+    for (size_t s = 0; s < g->n; s++) {
+        if (components[s] != -1) continue;
+        size_t len = 0;
+        stack[len++] = s;
+        components[s] = count;
+        while (len > 0) {
+            const Vertex* v = &g->vertices[stack[--len]];
+            for (VertexList* p = v->neighbors; p != NULL; p = p->next) {
+                size_t u = (size_t)(p->v - g->vertices);
+                if (components[u] == -1) {
+                    components[u] = count;
+                    stack[len++] = u;
+                }
+            }
+        }
+        count++;
+    }
+    free(stack);
+    return components;
+}
+
+
+static const struct {
+    const char* name;
+    Graph* (*generate)(size_t);
+} undirected_graph_kinds[] = {
+    { "random-tree", random_tree },
+    { "mesh", mesh },
+    { "plaw", power_law },
+};
+
+
+static void bench_connected_components(const size_t sizes[], size_t num_sizes,
+                                       const char* filter) {
+    if (filter != NULL && strstr("dfs_components", filter) == NULL
+            && strstr("connected_components/", filter) == NULL) {
+        return;
+    }
+    int thread_counts[] = { 1, 2, 4, 8 };
+    for (size_t kind = 0; kind < sizeof undirected_graph_kinds / sizeof undirected_graph_kinds[0];
+            kind++) {
+        for (size_t k = 0; k < num_sizes; k++) {
+            Graph* g = undirected_graph_kinds[kind].generate(sizes[k]);
+            const char* input = undirected_graph_kinds[kind].name;
+            int* expected = dfs_components(g);
+            Sample s;
+            if (filter == NULL || strstr("dfs_components", filter) != NULL) {
+                begin_sample(&s);
+                int* components = dfs_components(g);
+                end_sample(&s);
+                print_sample("dfs_components", input, g->n, &s);
+                free(components);
+            }
+            for (size_t t = 0; t < sizeof thread_counts / sizeof thread_counts[0]; t++) {
+                char name[32];
+                snprintf(name, sizeof name, "connected_components/%d", thread_counts[t]);
+                if (filter != NULL && strstr(name, filter) == NULL) continue;
+                size_t num_components;
+                begin_sample(&s);
+                int* components = connected_components(g, &num_components, thread_counts[t]);
+                end_threaded_sample(&s, thread_counts[t]);
+                if (memcmp(components, expected, g->n * sizeof *components) != 0) {
+                    printf("*  %s is not the same as dfs_components\n", name);
+                }
+                print_sample(name, input, g->n, &s);
+                free(components);
+            }
+            free(expected);
+            graph_free(g);
+        }
+    }
+}
+
+
+/* The distances from `source` to every vertex by an ordinary breadth-first search, as a baseline
+ * for multi_source_bfs. `queue` must have room for g->n vertex indices.
+ */
+static void bfs_distances(const Graph* g, size_t source, int* distances, size_t* queue) {
+    for (size_t v = 0; v < g->n; v++) {
+        distances[v] = -1;
+    }
+    size_t head = 0, tail = 0;
+    distances[source] = 0;
+    queue[tail++] = source;
+    while (head < tail) {
+        size_t v = queue[head++];
+        for (VertexList* p = g->vertices[v].neighbors; p != NULL; p = p->next) {
+            size_t u = p->v - g->vertices;
+            if (distances[u] == -1) {
+                distances[u] = distances[v] + 1;
+                queue[tail++] = u;
+            }
+        }
+    }
+}
+
+
+#define NUM_SOURCES 256
+
+/* Closeness statistics from NUM_SOURCES random sources of a random-deg8 graph, by one search per
+ * source and by multi-source BFS.
+ */
+static void bench_multi_source_bfs(const size_t sizes[], size_t num_sizes, const char* filter) {
+    bool run_single = filter == NULL || strstr("bfs_per_source", filter) != NULL;
+    bool run_multi = filter == NULL || strstr("multi_source_bfs_stats", filter) != NULL;
+    if (!run_single && !run_multi) return;
+    for (size_t k = 0; k < num_sizes && sizes[k] <= 100000; k++) {
+        size_t n = sizes[k];
+        Graph* g = random_deg8(n);
+        size_t sources[NUM_SOURCES];
+        for (size_t i = 0; i < NUM_SOURCES; i++) {
+            sources[i] = rng_next() % n;
+        }
+        size_t reached[NUM_SOURCES];
+        uint64_t sums[NUM_SOURCES], expected_sums[NUM_SOURCES];
+        Sample s;
+        if (run_single) {
+            int* distances = safe_malloc(n * sizeof *distances);
+            size_t* queue = safe_malloc(n * sizeof *queue);
+            begin_sample(&s);
+            for (size_t i = 0; i < NUM_SOURCES; i++) {
+                bfs_distances(g, sources[i], distances, queue);
+                expected_sums[i] = 0;
+                for (size_t v = 0; v < n; v++) {
+                    expected_sums[i] += distances[v] > 0 ? distances[v] : 0;
+                }
+            }
+            end_sample(&s);
+            print_sample("bfs_per_source", "random-deg8", n, &s);
+            free(distances);
+            free(queue);
+        }
+        if (run_multi) {
+            begin_sample(&s);
+            multi_source_bfs_stats(g, sources, NUM_SOURCES, reached, sums);
+            end_sample(&s);
+            if (run_single && memcmp(sums, expected_sums, sizeof sums) != 0) {
+                printf("*  multi_source_bfs_stats disagrees with bfs_per_source\n");
+            }
+            print_sample("multi_source_bfs_stats", "random-deg8", n, &s);
+        }
+        graph_free(g);
+    }
+}
+
+
+/* Insert 4n random edges into a TopologicalOrder of n vertices, all oriented along a hidden
+ * random order so that none of them is rejected, and compare to running topological_sort again
+ * after each insertion (for the small sizes only, since that is quadratic).
+ */
+static void bench_topological_order(const size_t sizes[], size_t num_sizes, const char* filter) {
+    bool run_dynamic = filter == NULL || strstr("topological_order", filter) != NULL;
+    bool run_recompute = filter == NULL || strstr("topological_sort_each", filter) != NULL;
+    for (size_t k = 0; k < num_sizes && sizes[k] <= 1000000; k++) {
+        size_t n = sizes[k], num_edges = 4 * n;
+        size_t* hidden = safe_malloc(n * sizeof *hidden);
+        for (size_t i = 0; i < n; i++) {
+            size_t j = rng_next() % (i + 1);
+            hidden[i] = hidden[j];
+            hidden[j] = i;
+        }
+        size_t* edges = safe_malloc(2 * num_edges * sizeof *edges);
+        for (size_t e = 0; e < num_edges; e++) {
+            size_t u = rng_next() % n, v = rng_next() % n;
+            if (u == v) v = (v + 1) % n;
+            bool forwards = hidden[u] < hidden[v];
+            edges[2*e] = forwards ? u : v;
+            edges[2*e + 1] = forwards ? v : u;
+        }
+        Sample s;
+        if (run_dynamic) {
+            TopologicalOrder* t = topological_order_new(n);
+            size_t rejected = 0;
+            begin_sample(&s);
+            for (size_t e = 0; e < num_edges; e++) {
+                rejected += !topological_order_add_edge(t, edges[2*e], edges[2*e + 1]);
+            }
+            end_sample(&s);
+            if (rejected > 0) {
+                printf("*  topological_order_add_edge rejected an edge of a DAG\n");
+            }
+            print_sample("topological_order", "random-dag", n, &s);
+            topological_order_free(t);
+        }
+        if (run_recompute && n <= 1000) {
+            Graph* g = graph_new(n);
+            begin_sample(&s);
+            for (size_t e = 0; e < num_edges; e++) {
+                graph_add_edge_index(g, edges[2*e], edges[2*e + 1]);
+                free(topological_sort(g));
+            }
+            end_sample(&s);
+            print_sample("topological_sort_each", "random-dag", n, &s);
+            graph_free(g);
+        }
+        free(hidden);
+        free(edges);
+    }
+}
+
+
+/* Warshall's algorithm on a matrix of bools, as a baseline for transitive_closure. */
+static void transitive_closure_bytes(bool* edges, size_t n) {
+    for (size_t k = 0; k < n; k++) {
+        for (size_t i = 0; i < n; i++) {
+            if (edges[i*n + k]) {
+                for (size_t j = 0; j < n; j++) {
+                    edges[i*n + j] |= edges[k*n + j];
+                }
+            }
+        }
+    }
+}
+
+
+/* Breadth-first search and transitive closure on random directed graphs where each edge is present
+ * with probability 1/16 (for the searches) or about 1/n (for the closures, so that the result is
+ * not simply every edge after the first few blocks).
+ */
+static void bench_dense_graphs(size_t max_n, const char* filter) {
+    static const size_t dense_sizes[] = { 500, 1000, 2000, 4000 };
+    for (size_t k = 0; k < sizeof dense_sizes / sizeof dense_sizes[0]; k++) {
+        size_t n = dense_sizes[k];
+        if (n > max_n) break;
+        GraphMatrix* m = graph_matrix_new(n);
+        for (size_t i = 0; i < n; i++) {
+            for (size_t j = 0; j < n; j++) {
+                if (rng_next() % 16 == 0) {
+                    graph_matrix_add_edge(m, i, j);
+                }
+            }
+        }
+        Graph* g = graph_from_matrix(m);
+        Sample s;
+        if (filter == NULL || strstr("bfs_mark_on_push", filter) != NULL) {
+            begin_sample(&s);
+            int* counts = breadth_first_search_mode(g, MARK_ON_PUSH);
+            end_sample(&s);
+            print_sample("bfs_mark_on_push", "dense-1/16", n, &s);
+            free(counts);
+        }
+        if (filter == NULL || strstr("bfs_matrix", filter) != NULL) {
+            begin_sample(&s);
+            int* levels = breadth_first_search_matrix(m, 0);
+            end_sample(&s);
+            print_sample("bfs_matrix", "dense-1/16", n, &s);
+            free(levels);
+        }
+        graph_free(g);
+        graph_matrix_free(m);
+
+        m = graph_matrix_new(n);
+        bool* edges = safe_calloc(n * n, sizeof *edges);
+        for (size_t e = 0; e < n; e++) {
+            size_t i = rng_next() % n, j = rng_next() % n;
+            graph_matrix_add_edge(m, i, j);
+            edges[i*n + j] = true;
+        }
+        if (filter == NULL || strstr("transitive_closure", filter) != NULL) {
+            begin_sample(&s);
+            transitive_closure(m);
+            end_sample(&s);
+            print_sample("transitive_closure", "random-1/n", n, &s);
+        }
+        if (filter == NULL || strstr("transitive_closure_bytes", filter) != NULL) {
+            begin_sample(&s);
+            transitive_closure_bytes(edges, n);
+            end_sample(&s);
+            print_sample("transitive_closure_bytes", "random-1/n", n, &s);
+        }
+        free(edges);
+        graph_matrix_free(m);
+    }
+}
+
+
+/* Run closest_pair_parallel on one thread and on every CPU. */
+static void bench_closest_pair(const size_t sizes[], size_t num_sizes, const char* filter) {
+    if (filter != NULL && strstr("closest_pair_parallel", filter) == NULL) return;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int thread_counts[] = { 1, cpus > 1 ? (int)cpus : 1 };
+    for (int t = 0; t < 2; t++) {
+        if (t == 1 && thread_counts[1] == 1) break;
+        char label[32];
+        snprintf(label, sizeof label, "%d-thread", thread_counts[t]);
+        for (size_t k = 0; k < num_sizes; k++) {
+            size_t n = sizes[k];
+            Point* points = safe_malloc(n * sizeof *points);
+            for (size_t i = 0; i < n; i++) {
+                points[i].x = (double)(rng_next() % 1000000007);
+                points[i].y = (double)(rng_next() % 1000000007);
+            }
+            Sample s;
+            begin_sample(&s);
+            double d = closest_pair_parallel(points, n, thread_counts[t]);
+            end_threaded_sample(&s, thread_counts[t]);
+            if (!(d >= 0)) {
+                printf("*  closest_pair_parallel returned %f\n", d);
+            }
+            print_sample("closest_pair_parallel", label, n, &s);
+            free(points);
+        }
+    }
+}
+
+
+/* Fill a ClosestPairSet with n random points, then replace a random point with a new one n times,
+ * querying the closest pair after each replacement. The time is for the replacements only.
+ */
+static void bench_closest_pair_set(const size_t sizes[], size_t num_sizes, const char* filter) {
+    if (filter != NULL && strstr("closest_pair_set", filter) == NULL) return;
+    for (size_t k = 0; k < num_sizes; k++) {
+        size_t n = sizes[k];
+        ClosestPairSet* set = closest_pair_set_new();
+        size_t* ids = safe_malloc(n * sizeof *ids);
+        for (size_t i = 0; i < n; i++) {
+            Point p = { (double)(rng_next() % 1000000007), (double)(rng_next() % 1000000007) };
+            ids[i] = closest_pair_set_insert(set, p);
+        }
+        double total = 0;
+        Sample s;
+        begin_sample(&s);
+        for (size_t i = 0; i < n; i++) {
+            size_t j = rng_next() % n;
+            closest_pair_set_remove(set, ids[j]);
+            Point p = { (double)(rng_next() % 1000000007), (double)(rng_next() % 1000000007) };
+            ids[j] = closest_pair_set_insert(set, p);
+            total += closest_pair_set_query(set, NULL, NULL);
+        }
+        end_sample(&s);
+        if (!(total >= 0)) {
+            printf("*  closest_pair_set_query returned a negative distance\n");
+        }
+        print_sample("closest_pair_set", "replace", n, &s);
+        free(ids);
+        closest_pair_set_free(set);
+    }
+}
+
+
+int main(int argc, char* argv[]) {
+    size_t max_n = 1000000;
+    const char* filter = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--perf") == 0) {
+            use_perf = true;
+        } else if (strcmp(argv[i], "--max-n") == 0 && i + 1 < argc) {
+            max_n = strtoull(argv[++i], NULL, 10);
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Usage: %s [--perf] [--max-n N] [FILTER]\n", argv[0]);
+            return 1;
+        } else {
+            filter = argv[i];
+        }
+    }
+
+    if (use_perf) {
+        perf_counters_open(&counters);
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            if (counters.fds[i] == -1) {
+                fprintf(stderr, "warning: the %s counter is not available on this machine\n",
+                        counter_names[i]);
+            }
+        }
+    }
+
+    size_t sizes[16];
+    size_t num_sizes = 0;
+    for (size_t n = 1000; n <= max_n && num_sizes < 15; n *= 10) {
+        sizes[num_sizes++] = n;
+    }
+    /* So that a size such as 25000000 (a power-law graph with 10^8 edges) can be run on its own. */
+    if (max_n >= 1000 && sizes[num_sizes-1] != max_n) {
+        sizes[num_sizes++] = max_n;
+    }
+
+    print_header();
+    bench_sorts(sizes, num_sizes, filter);
+    bench_selection(sizes, num_sizes, filter);
+    bench_argsorts(sizes, num_sizes, filter);
+    bench_merges(sizes, num_sizes, filter);
+    bench_searches(sizes, num_sizes, filter);
+    bench_lookups(sizes, num_sizes, filter);
+    bench_traversals(sizes, num_sizes, filter);
+    bench_vertex_orderings(sizes, num_sizes, filter);
+    bench_dense_graphs(max_n, filter);
+    bench_connected_components(sizes, num_sizes, filter);
+    bench_multi_source_bfs(sizes, num_sizes, filter);
+    bench_topological_order(sizes, num_sizes, filter);
+    bench_closest_pair(sizes, num_sizes, filter);
+    bench_closest_pair_set(sizes, num_sizes, filter);
+
+    if (use_perf) {
+        perf_counters_close(&counters);
+    }
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include "algorithms.h"
 
 
@@ -96,27 +97,50 @@ double closest_pair_brute_force(Point points[], size_t n) {
  *  Time analysis: The for loop iterates over every vertex in the graph, and the nested while loop
  *  considers each edge, so the time complexity is O(|E| + |V|).
  *
- *  Space analysis: O(|V|) in the worst case for the vertex stack (imagine a graph that looks like
- *  this: o->o->o->o).
+ *  Space analysis: O(|E|) in the worst case for the vertex stack, since a vertex is pushed once
+ *  for every edge into it that is seen before the vertex is visited. See depth_first_search_mode
+ *  for a variant that only needs O(|V|).
  */
 int* depth_first_search(const Graph* g) {
+    return depth_first_search_mode(g, MARK_ON_VISIT);
+}
+
+
+/* Traverse the graph depth-first, with vertices marked when they are visited (as in
+ * depth_first_search) or when they are first pushed onto the stack.
+ *
+ *  Marking a vertex when it is pushed means that it is pushed only once, so the stack never holds
+ *  more than |V| vertices and edges into vertices that are already on the stack are skipped
+ *  without a push or a pop. The price is that the order is no longer strictly depth-first: a
+ *  vertex is visited from the first of its neighbors to discover it, rather than the last.
+ */
+int* depth_first_search_mode(const Graph* g, enum TraversalMode mode) {
     if (g == NULL) return NULL;
     VertexStack* stack = stack_new(g->n);
+    /* 0 for vertices that haven't been seen, and -1 for vertices that have been marked but not
+     * visited yet.
+     */
     int* counts = safe_calloc(g->n, sizeof *counts);
     int max_count = 0;
     /* Start at each vertex to ensure that every component is visited. */
     for (size_t i = 0; i < g->n; i++) {
-        if (counts[i] > 0)
+        if (counts[i] != 0)
             /* Skip vertices that have already been traversed. */
             continue;
         stack_push(stack, g->vertices + i);
         /* This loop visits each vertex in a connected component. */
         while (!stack_empty(stack)) {
             Vertex* this_vertex = stack_pop(stack);
+            if (counts[this_vertex - g->vertices] > 0)
+                /* Pushed more than once, and already visited from an earlier push. */
+                continue;
             counts[this_vertex - g->vertices] = ++max_count;
             /* Push all adjacents vertices onto the stack. */
             for (VertexList* p = this_vertex->neighbors; p != NULL; p = p->next) {
                 if (counts[p->v - g->vertices] == 0) {
+                    if (mode == MARK_ON_PUSH) {
+                        counts[p->v - g->vertices] = -1;
+                    }
                     stack_push(stack, p->v);
                 }
             }
@@ -136,26 +160,47 @@ int* depth_first_search(const Graph* g) {
  *
  *  Time analysis: Same as depth-first search: O(|V| + |E|).
  *
- *  Space analysis: O(|V|) in the worst case for the vertex queue (imagine a graph where every
- *  vertex was connected only to a single central vertex).
+ *  Space analysis: O(|E|) in the worst case for the vertex queue, as for depth-first search.
  */
 int* breadth_first_search(const Graph* g) {
+    return breadth_first_search_mode(g, MARK_ON_VISIT);
+}
+
+
+/* Traverse the graph breadth-first, with vertices marked when they are visited (as in
+ * breadth_first_search) or when they are first pushed onto the queue.
+ *
+ *  For breadth-first search, marking a vertex when it is pushed gives exactly the same order, since
+ *  a vertex's first push is also the one that is popped first. But the queue never holds more than
+ *  |V| vertices, instead of up to |E|.
+ */
+int* breadth_first_search_mode(const Graph* g, enum TraversalMode mode) {
+    if (g == NULL) return NULL;
     VertexQueue* queue = queue_new(g->n);
+    /* 0 for vertices that haven't been seen, and -1 for vertices that have been marked but not
+     * visited yet.
+     */
     int* counts = safe_calloc(g->n, sizeof *counts);
     int max_count = 0;
     /* Start at each vertex to ensure that every component is visited. */
     for (size_t i = 0; i < g->n; i++) {
-        if (counts[i] > 0)
+        if (counts[i] != 0)
             /* Skip vertices that have already been traversed. */
             continue;
         queue_push(queue, g->vertices + i);
         /* This loop visits each vertex in a connected component. */
         while (!queue_empty(queue)) {
             Vertex* this_vertex = queue_pop(queue);
+            if (counts[this_vertex - g->vertices] > 0)
+                /* Pushed more than once, and already visited from an earlier push. */
+                continue;
             counts[this_vertex - g->vertices] = ++max_count;
-            /* Push all adjacents vertices onto the stack. */
+            /* Push all adjacents vertices onto the queue. */
             for (VertexList* p = this_vertex->neighbors; p != NULL; p = p->next) {
                 if (counts[p->v - g->vertices] == 0) {
+                    if (mode == MARK_ON_PUSH) {
+                        counts[p->v - g->vertices] = -1;
+                    }
                     queue_push(queue, p->v);
                 }
             }
@@ -166,6 +211,233 @@ int* breadth_first_search(const Graph* g) {
 }
 
 
+/* Return a heap-allocated array of the number of edges on a shortest path from `source` to each
+ * vertex of the adjacency matrix, or -1 for vertices that cannot be reached from it.
+ *
+ *  Idea: Breadth-first search one level at a time, with the frontier (the vertices at the current
+ *  distance) and the visited vertices kept as bitsets. The next frontier is the OR of the rows of
+ *  the vertices in the frontier, AND NOT the visited vertices, which takes one operation for every
+ *  64 columns.
+ *
+ *  Time analysis: Each vertex is in the frontier once, and ORing in its row takes |V| / 64 word
+ *  operations, so O(|V|^2 / 64) regardless of the number of edges.
+ *
+ *  Space analysis: O(|V|) for the bitsets.
+ */
+int* breadth_first_search_matrix(const GraphMatrix* m, size_t source) {
+    int* levels = safe_malloc((m->n > 0 ? m->n : 1) * sizeof *levels);
+    for (size_t i = 0; i < m->n; i++) {
+        levels[i] = -1;
+    }
+    if (source >= m->n) return levels;
+    size_t words = m->words;
+    uint64_t* frontier = safe_calloc(words, sizeof *frontier);
+    uint64_t* next = safe_calloc(words, sizeof *next);
+    uint64_t* visited = safe_calloc(words, sizeof *visited);
+    frontier[source / 64] = visited[source / 64] = (uint64_t)1 << (source % 64);
+    levels[source] = 0;
+    for (int level = 1; ; level++) {
+        memset(next, 0, words * sizeof *next);
+        for (size_t w = 0; w < words; w++) {
+            for (uint64_t bits = frontier[w]; bits != 0; bits &= bits - 1) {
+                const uint64_t* row = MATRIX_ROW(m, 64*w + __builtin_ctzll(bits));
+                for (size_t x = 0; x < words; x++) {
+                    next[x] |= row[x];
+                }
+            }
+        }
+        bool found = false;
+        for (size_t x = 0; x < words; x++) {
+            next[x] &= ~visited[x];
+            visited[x] |= next[x];
+            for (uint64_t bits = next[x]; bits != 0; bits &= bits - 1) {
+                levels[64*x + __builtin_ctzll(bits)] = level;
+                found = true;
+            }
+        }
+        if (!found) break;
+        uint64_t* tmp = frontier;
+        frontier = next;
+        next = tmp;
+    }
+    free(frontier);
+    free(next);
+    free(visited);
+    return levels;
+}
+
+
+/* The number of searches that multi_source_bfs runs at once, and the number of 64-bit words in
+ * the set of them that have seen a vertex.
+ */
+#define MSBFS_BATCH 256
+#define MSBFS_WORDS (MSBFS_BATCH / 64)
+
+/* A set of the searches in a batch, with search i as bit i % 64 of word i / 64. */
+typedef struct {
+    uint64_t w[MSBFS_WORDS];
+} SourceSet;
+
+/* Where multi_source_bfs_batch records the vertices that each search reaches. Any of the arrays may
+ * be NULL, and all of them are indexed by search, from the first search of the batch.
+ */
+typedef struct {
+    /* distances[i*n + v] is the distance from search i's source to v. */
+    int* distances;
+    size_t* reached;
+    uint64_t* distance_sums;
+} SearchResults;
+
+static void record_searches(SearchResults* out, size_t n, size_t v, const SourceSet* found,
+                            int level) {
+    for (int w = 0; w < MSBFS_WORDS; w++) {
+        for (uint64_t bits = found->w[w]; bits != 0; bits &= bits - 1) {
+            size_t i = 64*w + __builtin_ctzll(bits);
+            if (out->distances != NULL) out->distances[i*n + v] = level;
+            if (out->reached != NULL) out->reached[i]++;
+            if (out->distance_sums != NULL) out->distance_sums[i] += level;
+        }
+    }
+}
+
+
+/* Run breadth-first searches from up to MSBFS_BATCH sources at once. `seen`, `visit` and `next`
+ * must have room for n sets each.
+ */
+static void multi_source_bfs_batch(const Graph* g, const size_t sources[], size_t k,
+                                   SearchResults* out, SourceSet* seen, SourceSet* visit,
+                                   SourceSet* next) {
+    size_t n = g->n;
+    memset(seen, 0, n * sizeof *seen);
+    memset(visit, 0, n * sizeof *visit);
+    memset(next, 0, n * sizeof *next);
+    for (size_t i = 0; i < k; i++) {
+        seen[sources[i]].w[i / 64] |= (uint64_t)1 << (i % 64);
+        visit[sources[i]].w[i / 64] |= (uint64_t)1 << (i % 64);
+    }
+    for (size_t v = 0; v < n; v++) {
+        record_searches(out, n, v, &visit[v], 0);
+    }
+    for (int level = 1; ; level++) {
+        /* Each vertex passes the searches that are visiting it to its neighbors, with one scan of
+         * its edges for all of them.
+         */
+        for (size_t v = 0; v < n; v++) {
+            uint64_t any = 0;
+            for (int w = 0; w < MSBFS_WORDS; w++) {
+                any |= visit[v].w[w];
+            }
+            if (any == 0) continue;
+            for (VertexList* p = g->vertices[v].neighbors; p != NULL; p = p->next) {
+                SourceSet* to = &next[p->v - g->vertices];
+                for (int w = 0; w < MSBFS_WORDS; w++) {
+                    to->w[w] |= visit[v].w[w];
+                }
+            }
+        }
+        /* Keep only the searches that reach each vertex for the first time. */
+        bool found = false;
+        for (size_t v = 0; v < n; v++) {
+            uint64_t any = 0;
+            for (int w = 0; w < MSBFS_WORDS; w++) {
+                next[v].w[w] &= ~seen[v].w[w];
+                seen[v].w[w] |= next[v].w[w];
+                any |= next[v].w[w];
+            }
+            if (any != 0) {
+                record_searches(out, n, v, &next[v], level);
+                found = true;
+            }
+        }
+        if (!found) break;
+        SourceSet* tmp = visit;
+        visit = next;
+        next = tmp;
+        memset(next, 0, n * sizeof *next);
+    }
+}
+
+
+/* Run multi_source_bfs_batch on each batch of sources in turn. */
+static void multi_source_bfs_all(const Graph* g, const size_t sources[], size_t k,
+                                 SearchResults out) {
+    size_t n = g->n;
+    SourceSet* seen = safe_malloc((n > 0 ? n : 1) * sizeof *seen);
+    SourceSet* visit = safe_malloc((n > 0 ? n : 1) * sizeof *visit);
+    SourceSet* next = safe_malloc((n > 0 ? n : 1) * sizeof *next);
+    for (size_t start = 0; start < k; start += MSBFS_BATCH) {
+        size_t batch = k - start < MSBFS_BATCH ? k - start : MSBFS_BATCH;
+        SearchResults batch_out = {
+            out.distances != NULL ? out.distances + start * n : NULL,
+            out.reached != NULL ? out.reached + start : NULL,
+            out.distance_sums != NULL ? out.distance_sums + start : NULL,
+        };
+        multi_source_bfs_batch(g, sources + start, batch, &batch_out, seen, visit, next);
+    }
+    free(seen);
+    free(visit);
+    free(next);
+}
+
+
+/* Run a breadth-first search from each of the `k` vertices in `sources`, and return a
+ * heap-allocated array of k*n distances, where entry i*n + v is the number of edges on a shortest
+ * path from sources[i] to v, or -1 if v cannot be reached from it.
+ *
+ *  Idea: Run the searches MSBFS_BATCH at a time, in lockstep (multi-source BFS). For every vertex,
+ *  keep the set of searches that have seen it and the set that are visiting it at the current
+ *  level, as bitsets. Each level then scans the edges of every vertex being visited by any search
+ *  once, ORing the set of searches visiting it into the sets for its neighbors, instead of once
+ *  for every search. Searches from nearby sources overlap heavily, so most of the edge scans are
+ *  shared.
+ *
+ *  Time analysis: O(k/B * L * (|V| + |E|)) for batches of B searches with at most L levels each,
+ *  plus O(k|V|) to record the distances, compared to O(k(|V| + |E|)) for separate searches. In the
+ *  worst case L is |V|, but for most graphs it is small and the edge scans, which are random
+ *  memory accesses, are shared B ways.
+ *
+ *  Space analysis: O(|V|) for three sets per vertex, besides the result.
+ */
+int* multi_source_bfs(const Graph* g, const size_t sources[], size_t k) {
+    int* distances = safe_malloc((k * g->n > 0 ? k * g->n : 1) * sizeof *distances);
+    for (size_t i = 0; i < k * g->n; i++) {
+        distances[i] = -1;
+    }
+    SearchResults out = { distances, NULL, NULL };
+    multi_source_bfs_all(g, sources, k, out);
+    return distances;
+}
+
+
+/* The same as multi_source_bfs, but instead of the distances, store the number of vertices that
+ * each source reaches (including itself) in reached[i], and the sum of the distances to them in
+ * distance_sums[i], which together give the closeness centrality of each source.
+ */
+void multi_source_bfs_stats(const Graph* g, const size_t sources[], size_t k, size_t reached[],
+                            uint64_t distance_sums[]) {
+    memset(reached, 0, k * sizeof *reached);
+    memset(distance_sums, 0, k * sizeof *distance_sums);
+    SearchResults out = { NULL, reached, distance_sums };
+    multi_source_bfs_all(g, sources, k, out);
+}
+
+
+/* Return true if `counts` numbers the `n` vertices 1 through n, in some order. */
+static bool is_visit_order(const int counts[], size_t n) {
+    bool* seen = safe_calloc(n + 1, sizeof *seen);
+    bool ok = true;
+    for (size_t i = 0; i < n; i++) {
+        if (counts[i] < 1 || (size_t)counts[i] > n || seen[counts[i]]) {
+            ok = false;
+            break;
+        }
+        seen[counts[i]] = true;
+    }
+    free(seen);
+    return ok;
+}
+
+
 int ch03_tests() {
     puts("\n=== CHAPTER 3 TESTS ===");
     int tests_failed = 0;
@@ -200,7 +472,131 @@ int ch03_tests() {
     /* Expected order: A, C, B, F, E, G, D */
     ASSERT(array_eq(7, counts, 1, 3, 2, 7, 5, 4, 6));
     free(counts);
+    counts = breadth_first_search_mode(g, MARK_ON_PUSH);
+    ASSERT(array_eq(7, counts, 1, 3, 2, 7, 5, 4, 6));
+    free(counts);
+    counts = depth_first_search_mode(g, MARK_ON_PUSH);
+    /* The same order as above, since no vertex on this graph is discovered by two neighbors before
+     * it is visited.
+     */
+    ASSERT(array_eq(7, counts, 1, 2, 6, 7, 5, 4, 3));
+    free(counts);
     graph_free(g);
 
+    /* A complete graph, where marking on visit pushes every vertex many times. */
+    puts("Testing traversals of a dense graph");
+    Graph* dense = graph_new(60);
+    for (size_t i = 0; i < 60; i++) {
+        for (size_t j = 0; j < 60; j++) {
+            if (i != j) {
+                graph_add_edge_index(dense, i, j);
+            }
+        }
+    }
+    int* dfs_visit = depth_first_search_mode(dense, MARK_ON_VISIT);
+    int* dfs_push = depth_first_search_mode(dense, MARK_ON_PUSH);
+    int* bfs_visit = breadth_first_search_mode(dense, MARK_ON_VISIT);
+    int* bfs_push = breadth_first_search_mode(dense, MARK_ON_PUSH);
+    ASSERT(is_visit_order(dfs_visit, 60) && is_visit_order(dfs_push, 60));
+    ASSERT(is_visit_order(bfs_visit, 60));
+    ASSERT(memcmp(bfs_visit, bfs_push, 60 * sizeof *bfs_visit) == 0);
+    free(dfs_visit);
+    free(dfs_push);
+    free(bfs_visit);
+    free(bfs_push);
+    graph_free(dense);
+
+    /* BREADTH-FIRST SEARCH ON AN ADJACENCY MATRIX */
+    puts("Testing breadth-first search on an adjacency matrix");
+    g = graph_from_string(DIRECTED, "ABCDEFG", "AB AC BG BE CF DA DB DC DF DG GF");
+    GraphMatrix* matrix = graph_matrix_from_graph(g);
+    int* levels = breadth_first_search_matrix(matrix, 0);
+    ASSERT(array_eq(7, levels, 0, 1, 1, -1, 2, 2, 2));
+    free(levels);
+    levels = breadth_first_search_matrix(matrix, 3);
+    ASSERT(array_eq(7, levels, 1, 1, 1, 0, 2, 1, 1));
+    free(levels);
+    /* Converting back and forth gives the same edges and values. */
+    Graph* from_matrix = graph_from_matrix(matrix);
+    GraphMatrix* round_trip = graph_matrix_from_graph(from_matrix);
+    ASSERT(memcmp(matrix->edges, round_trip->edges, 7 * sizeof *matrix->edges) == 0);
+    ASSERT(memcmp(round_trip->vals, "ABCDEFG", 7) == 0);
+    graph_matrix_free(round_trip);
+    graph_free(from_matrix);
+    graph_matrix_free(matrix);
+    graph_free(g);
+
+    /* MULTI-SOURCE BREADTH-FIRST SEARCH */
+    puts("Testing multi-source breadth-first search");
+    /* More sources than a batch, including a repeated source, checked against a separate search
+     * from each source.
+     */
+    size_t msbfs_n = 300, msbfs_k = 300;
+    Graph* sparse = graph_new(msbfs_n);
+    unsigned int state = 5;
+    for (size_t v = 0; v < msbfs_n; v++) {
+        for (int e = 0; e < 2; e++) {
+            state = state * 1103515245 + 12345;
+            graph_add_edge_index(sparse, v, (state >> 8) % msbfs_n);
+        }
+    }
+    size_t* sources = safe_malloc(msbfs_k * sizeof *sources);
+    for (size_t i = 0; i < msbfs_k; i++) {
+        sources[i] = (i * 7) % msbfs_n;
+    }
+    sources[299] = sources[0];
+    int* distances = multi_source_bfs(sparse, sources, msbfs_k);
+    size_t* reached = safe_malloc(msbfs_k * sizeof *reached);
+    uint64_t* distance_sums = safe_malloc(msbfs_k * sizeof *distance_sums);
+    multi_source_bfs_stats(sparse, sources, msbfs_k, reached, distance_sums);
+    GraphMatrix* sparse_matrix = graph_matrix_from_graph(sparse);
+    int msbfs_ok = 1;
+    for (size_t i = 0; i < msbfs_k; i++) {
+        levels = breadth_first_search_matrix(sparse_matrix, sources[i]);
+        size_t expected_reached = 0;
+        uint64_t expected_sum = 0;
+        for (size_t v = 0; v < msbfs_n; v++) {
+            msbfs_ok &= distances[i*msbfs_n + v] == levels[v];
+            if (levels[v] >= 0) {
+                expected_reached++;
+                expected_sum += levels[v];
+            }
+        }
+        msbfs_ok &= reached[i] == expected_reached && distance_sums[i] == expected_sum;
+        free(levels);
+    }
+    ASSERT(msbfs_ok);
+    free(distances);
+    free(reached);
+    free(distance_sums);
+    free(sources);
+    graph_matrix_free(sparse_matrix);
+    graph_free(sparse);
+
+    /* STACKS AND QUEUES */
+    puts("Testing vertex stack and queue growth");
+    Vertex vertices[100];
+    VertexStack* stack = stack_new(1);
+    VertexQueue* queue = queue_new(1);
+    int stack_queue_ok = 1;
+    /* Interleave pushes and pops so that the queue wraps around before it grows. */
+    size_t popped = 0;
+    for (size_t i = 0; i < 100; i++) {
+        stack_push(stack, vertices + i);
+        queue_push(queue, vertices + i);
+        if (i % 3 == 2) {
+            stack_queue_ok &= queue_pop(queue) == vertices + popped++;
+        }
+    }
+    while (!queue_empty(queue)) {
+        stack_queue_ok &= queue_pop(queue) == vertices + popped++;
+    }
+    for (size_t i = 100; i-- > 0; ) {
+        stack_queue_ok &= stack_pop(stack) == vertices + i;
+    }
+    ASSERT(stack_queue_ok && popped == 100 && stack_empty(stack));
+    stack_free(stack);
+    queue_free(queue);
+
     return tests_failed;
 }
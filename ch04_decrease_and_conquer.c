@@ -59,10 +59,254 @@ long long binary_search(int array[], size_t n, int datum) {
 }
 
 
+/* The number of interpolation probes that can fail to halve the range before interpolation_search
+ * falls back to binary search for good.
+ */
+#define INTERPOLATION_MISSES 3
+
+
+/* Return the first position of `datum` in the sorted array, or -1 if `datum` is not present.
+ *
+ *   Idea: Instead of always probing the middle of the range that could hold the datum, guess its
+ *   position by interpolating linearly between the first and last elements of the range, which
+ *   on evenly spread keys lands on or next to the datum right away. On skewed keys interpolation
+ *   can creep along one element at a time, so whenever a probe fails to halve the range, the next
+ *   probe is at the middle of the range, as in binary search, and after INTERPOLATION_MISSES such
+ *   failures, all the rest are.
+ *
+ *   Time analysis: O(log log n) on average for uniformly distributed keys. Since every probe but
+ *   the first few halves the range, the worst case is O(log n), the same as binary search.
+ *
+ *   Space analysis: O(1).
+ */
+long long interpolation_search(int array[], size_t n, int datum) {
+    /* Every element before `start` is less than the datum, and every element from `end` on is at
+     * least the datum.
+     */
+    size_t start = 0, end = n;
+    bool bisect = false;
+    int misses = 0;
+    while (start < end) {
+        int low = array[start], high = array[end-1];
+        if (datum <= low) {
+            end = start;
+            break;
+        } else if (datum > high) {
+            start = end;
+            break;
+        }
+        size_t probe;
+        if (bisect) {
+            probe = start + (end - start) / 2;
+        } else {
+            /* low < datum <= high, so the guess is within the range. */
+            double fraction = ((double)datum - low) / ((double)high - low);
+            probe = start + (size_t)(fraction * (double)(end - 1 - start));
+        }
+        size_t old_len = end - start;
+        if (array[probe] < datum) {
+            start = probe + 1;
+        } else {
+            end = probe;
+        }
+        if (!bisect && 2 * (end - start) > old_len) {
+            misses++;
+            bisect = true;
+        } else {
+            bisect = misses >= INTERPOLATION_MISSES;
+        }
+    }
+    return end < n && array[end] == datum ? (long long)end : -1;
+}
+
+
+/* Return the index of the median of array[start], array[mid] and array[end]. */
+static size_t median_of_three(int array[], size_t start, size_t end) {
+    size_t mid = start + (end - start) / 2;
+    int a = array[start], b = array[mid], c = array[end];
+    if (a < b) {
+        return b < c ? mid : (a < c ? end : start);
+    } else {
+        return a < c ? start : (b < c ? end : mid);
+    }
+}
+
+
+static void nth_element_helper(int array[], size_t start, size_t end, size_t k, int depth);
+
+/* Return the index of a pivot in array[start...end] that is guaranteed to have at least about 30%
+ * of the elements on each side of it.
+ *
+ *   Idea: Split the array into groups of five and find the median of each group. Move the medians
+ *   to the front of the array and recursively select the median of the medians. Half of the
+ *   medians are no larger than it, and each of them has two more elements in its group that are no
+ *   larger, so at least 3/10 of the elements are no larger than the median of medians, and by
+ *   symmetry at least 3/10 are no smaller.
+ */
+static size_t median_of_medians(int array[], size_t start, size_t end) {
+    size_t n = end - start + 1;
+    size_t num_groups = 0;
+    for (size_t g = start; g <= end; g += 5) {
+        size_t group_end = g + 4 <= end ? g + 4 : end;
+        /* Insertion sort the group. */
+        for (size_t i = g + 1; i <= group_end; i++) {
+            int v = array[i];
+            size_t j = i;
+            while (j > g && array[j-1] > v) {
+                array[j] = array[j-1];
+                j--;
+            }
+            array[j] = v;
+        }
+        swap(array, start + num_groups++, g + (group_end - g) / 2);
+    }
+    if (n <= 5) {
+        return start;
+    }
+    size_t mid = start + (num_groups - 1) / 2;
+    /* The median of the medians is found with a depth of 0, so it is found with median of medians
+     * as well, which keeps the whole algorithm linear.
+     */
+    nth_element_helper(array, start, start + num_groups - 1, mid, 0);
+    return mid;
+}
+
+
+static void nth_element_helper(int array[], size_t start, size_t end, size_t k, int depth) {
+    while (start < end) {
+        size_t pivot = depth-- > 0 ? median_of_three(array, start, end)
+                                   : median_of_medians(array, start, end);
+        /* partition (from chapter 5) uses the first element as the pivot. */
+        swap(array, start, pivot);
+        size_t s = partition(array, start, end);
+        /* Everything in array[start...s] is no larger than everything in array[s+1...end], so
+         * only the side that contains position k needs to be considered any further.
+         */
+        if (k <= s) {
+            end = s;
+        } else {
+            start = s + 1;
+        }
+    }
+}
+
+
+/* Rearrange `array` so that array[k] is the element that would be in that position if the array
+ * were sorted, every element before it is no larger than it and every element after it is no
+ * smaller.
+ *
+ *   Idea: Partition the array around a pivot as in quicksort, but only continue with the side that
+ *   contains position k. Pivots are chosen with the median of three, which is fast on average; if
+ *   that takes too many partitions (which can happen on adversarial inputs), switch to the slower
+ *   median of medians, which guarantees that each partition discards a constant fraction of the
+ *   array. This combination is known as introselect.
+ *
+ *   Time analysis: O(n) on average, since the partitions take n + n/2 + n/4 + ... < 2n steps when
+ *   the pivots split the array roughly in half. In the worst case, O(n log n) steps are spent
+ *   before switching to median of medians, after which the recurrence
+ *   T(n) = T(n/5) + T(7n/10) + O(n) gives O(n), so O(n log n) overall.
+ *
+ *   Space analysis: O(log n) for the recursion in median_of_medians.
+ */
+void nth_element(int array[], size_t n, size_t k) {
+    if (k >= n) return;
+    int depth = 0;
+    for (size_t m = n; m > 1; m /= 2) {
+        depth += 2;
+    }
+    nth_element_helper(array, 0, n - 1, k, depth);
+}
+
+
+/* Return the k'th smallest element of the array (starting from 0), rearranging the array as
+ * nth_element does. `k` must be less than `n`.
+ */
+int quickselect(int array[], size_t n, size_t k) {
+    nth_element(array, n, k);
+    return array[k];
+}
+
+
+/* Rearrange `array` so that its first `k` elements are the k smallest elements of the array, in
+ * ascending order. The order of the rest of the array is unspecified.
+ *
+ *   Idea: Use nth_element to move the k smallest elements to the front, and then sort them.
+ *
+ *   Time analysis: O(n) for nth_element plus O(k log k) for the sort.
+ *
+ *   Space analysis: O(log n).
+ */
+void partial_sort(int array[], size_t n, size_t k) {
+    if (k > n) k = n;
+    if (k == 0) return;
+    if (k < n) {
+        nth_element(array, n, k - 1);
+    }
+    i32_quicksort(array, k);
+}
+
+
+/* Create an empty collector for the `k` smallest elements of a stream. */
+TopK* top_k_new(size_t k) {
+    TopK* ret = safe_malloc(sizeof *ret);
+    ret->k = k;
+    ret->len = 0;
+    ret->heap = safe_malloc((k > 0 ? k : 1) * sizeof *ret->heap);
+    return ret;
+}
+
+
+void top_k_free(TopK* t) {
+    free(t->heap);
+    free(t);
+}
+
+
+/* Add an element of the stream to the collector.
+ *
+ *   Idea: Keep the k smallest elements seen so far in a max heap (from chapter 6), so that the
+ *   largest of them is at the root. A new element only needs to be kept if it is smaller than the
+ *   root, in which case it replaces the root and is sifted down with fix_heap.
+ *
+ *   Time analysis: O(log k) in the worst case, and O(1) for the (typically vast majority of)
+ *   elements that are not smaller than the root.
+ *
+ *   Space analysis: O(1), with O(k) for the collector as a whole.
+ */
+void top_k_push(TopK* t, int x) {
+    if (t->len < t->k) {
+        /* The heap invariant is only needed once the heap is full. */
+        t->heap[t->len++] = x;
+        if (t->len == t->k) {
+            heapify(t->heap, t->len);
+        }
+    } else if (t->k > 0 && x < t->heap[0]) {
+        t->heap[0] = x;
+        fix_heap(0, t->heap, t->k);
+    }
+}
+
+
+/* Write the (up to) k smallest elements pushed so far to `out` in ascending order, and return how
+ * many were written.
+ */
+size_t top_k_result(const TopK* t, int out[]) {
+    for (size_t i = 0; i < t->len; i++) {
+        out[i] = t->heap[i];
+    }
+    i32_quicksort(out, t->len);
+    return t->len;
+}
+
+
 /* Return an ordering of a directed acyclic graph so that all edges point forwards along the
  * ordering. The return value is a malloc'd array `ranks` where `ranks[i]` is equal to the i'th
  * vertex's position in the sort. Multiple vertices may receive the same rank.
  *
+ * If the graph has a cycle, the vertices on it never become sources, and neither does any vertex
+ * that can be reached from it, so their ranks are meaningless. To rank a graph that may have
+ * cycles, rank its condensation instead (see strongly_connected_components).
+ *
  *   Idea: Identify a "source," a vertex with no incoming edges. Give this vertex a rank of 0 and
  *   remove all its outgoing edges from the graph. Find another source in the new graph, and
  *   continue.
@@ -108,6 +352,296 @@ int* topological_sort(const Graph* g) {
 }
 
 
+SORTING_DEFINE_STATIC(ordered_vertex, OrderedVertex, LESS_THAN_KEY)
+
+
+/* Create a graph of `n` vertices and no edges, in the order 0, 1, ..., n-1.
+ *
+ *   Idea: The Pearce-Kelly algorithm. Adding an edge from x to y that already points forwards in
+ *   the order needs no changes. Otherwise, the only vertices that can be out of order afterwards
+ *   are the ones between y and x in the order: those reachable from y (which must move after x)
+ *   and those that reach x (which must move before y). Find the first set with a depth-first
+ *   search forwards from y that ignores vertices after x, and the second with a search backwards
+ *   from x that ignores vertices before y. If the first search reaches x, the edge would close a
+ *   cycle. Otherwise, the two sets are disjoint, and the positions that they occupy can be reused:
+ *   put the vertices that reach x in the first of them, in their old relative order, followed by
+ *   the vertices reachable from y.
+ *
+ *   Time analysis: Adding an edge takes O(|A| log |A|), where A is the set of vertices found by the
+ *   searches and their edges, which is often much smaller than the whole graph, instead of the
+ *   O(|V| + |E|) it would take to run topological_sort again.
+ *
+ *   Space analysis: O(|V|) for the order and the searches, besides the edges.
+ */
+TopologicalOrder* topological_order_new(size_t n) {
+    TopologicalOrder* ret = safe_malloc(sizeof *ret);
+    size_t size = n > 0 ? n : 1;
+    ret->graph = graph_new(n);
+    ret->reverse = graph_new(n);
+    ret->order = safe_malloc(size * sizeof *ret->order);
+    ret->vertex_at = safe_malloc(size * sizeof *ret->vertex_at);
+    for (size_t v = 0; v < n; v++) {
+        ret->order[v] = ret->vertex_at[v] = v;
+    }
+    ret->visited = safe_calloc(size, sizeof *ret->visited);
+    ret->stack = safe_malloc(size * sizeof *ret->stack);
+    ret->forward = safe_malloc(size * sizeof *ret->forward);
+    ret->backward = safe_malloc(size * sizeof *ret->backward);
+    ret->positions = safe_malloc(size * sizeof *ret->positions);
+    return ret;
+}
+
+
+void topological_order_free(TopologicalOrder* t) {
+    graph_free(t->graph);
+    graph_free(t->reverse);
+    free(t->order);
+    free(t->vertex_at);
+    free(t->visited);
+    free(t->stack);
+    free(t->forward);
+    free(t->backward);
+    free(t->positions);
+    free(t);
+}
+
+
+/* Depth-first search `g` from `start`, skipping vertices whose position is outside [lo, hi], and
+ * store the vertices found in `found` with their positions. Return the number found, or SIZE_MAX
+ * if the search reaches `target`.
+ */
+static size_t bounded_search(TopologicalOrder* t, const Graph* g, size_t start, size_t lo,
+                             size_t hi, size_t target, OrderedVertex found[]) {
+    size_t len = 0, stack_len = 0;
+    bool reached_target = false;
+    t->stack[stack_len++] = start;
+    t->visited[start] = true;
+    while (stack_len > 0 && !reached_target) {
+        size_t v = t->stack[--stack_len];
+        found[len].key = t->order[v];
+        found[len].vertex = v;
+        len++;
+        for (VertexList* p = g->vertices[v].neighbors; p != NULL; p = p->next) {
+            size_t u = p->v - g->vertices;
+            if (u == target) {
+                reached_target = true;
+                break;
+            }
+            if (!t->visited[u] && t->order[u] >= lo && t->order[u] <= hi) {
+                t->visited[u] = true;
+                t->stack[stack_len++] = u;
+            }
+        }
+    }
+    /* Clear the marks of everything that was pushed, whether or not it was popped. */
+    for (size_t i = 0; i < len; i++) {
+        t->visited[found[i].vertex] = false;
+    }
+    for (size_t i = 0; i < stack_len; i++) {
+        t->visited[t->stack[i]] = false;
+    }
+    return reached_target ? SIZE_MAX : len;
+}
+
+
+/* Add an edge from `from` to `to`, and return true, unless it would create a cycle, in which case
+ * the graph is left unchanged and false is returned.
+ */
+bool topological_order_add_edge(TopologicalOrder* t, size_t from, size_t to) {
+    size_t lo = t->order[to], hi = t->order[from];
+    if (from == to) {
+        return false;
+    }
+    if (lo < hi) {
+        size_t num_forward = bounded_search(t, t->graph, to, lo, hi, from, t->forward);
+        if (num_forward == SIZE_MAX) {
+            return false;
+        }
+        size_t num_backward = bounded_search(t, t->reverse, from, lo, hi, SIZE_MAX, t->backward);
+        ordered_vertex_quicksort(t->forward, num_forward);
+        ordered_vertex_quicksort(t->backward, num_backward);
+        /* Merge the positions of the two sets, and hand them out again: first to the vertices
+         * that reach `from`, then to the vertices reachable from `to`.
+         */
+        size_t i = 0, j = 0, k = 0;
+        while (i < num_backward || j < num_forward) {
+            if (j == num_forward || (i < num_backward && t->backward[i].key < t->forward[j].key)) {
+                t->positions[k++] = t->backward[i++].key;
+            } else {
+                t->positions[k++] = t->forward[j++].key;
+            }
+        }
+        k = 0;
+        for (i = 0; i < num_backward; i++) {
+            t->order[t->backward[i].vertex] = t->positions[k];
+            t->vertex_at[t->positions[k++]] = t->backward[i].vertex;
+        }
+        for (j = 0; j < num_forward; j++) {
+            t->order[t->forward[j].vertex] = t->positions[k];
+            t->vertex_at[t->positions[k++]] = t->forward[j].vertex;
+        }
+    }
+    graph_add_edge_index(t->graph, from, to);
+    graph_add_edge_index(t->reverse, to, from);
+    return true;
+}
+
+
+/* A vertex whose edges strongly_connected_components is partway through, in place of a frame of
+ * the recursion in Tarjan's algorithm.
+ */
+typedef struct {
+    size_t v;
+    VertexList* next_edge;
+} SearchFrame;
+
+#define UNVISITED SIZE_MAX
+
+/* Return a malloc'd array of the strongly connected component of each vertex of a directed graph,
+ * and store the number of components in `num_components`. Two vertices are in the same component
+ * if and only if each can be reached from the other. The components are numbered from 0 in
+ * topological order: every edge between two components goes from a lower number to a higher one.
+ *
+ *   Idea: Tarjan's algorithm. Depth-first search the graph, numbering the vertices in the order
+ *   they are discovered and pushing each one onto a stack of vertices whose component is not known
+ *   yet. For each vertex, keep track of the lowest number of any vertex still on that stack that
+ *   it can reach through its descendants in the search (its "low link"). When the search finishes
+ *   a vertex whose low link is its own number, nothing below it reaches further back, so it and
+ *   everything above it on the stack form a component. Components are completed after every
+ *   component that they can reach, so numbering them backwards gives a topological order.
+ *
+ *   The depth-first search uses an explicit stack of (vertex, next edge) frames instead of
+ *   recursion, so that a path of millions of vertices cannot overflow the call stack.
+ *
+ *   Time analysis: Every vertex is pushed and popped once from each stack and every edge is
+ *   followed once, so O(|V| + |E|).
+ *
+ *   Space analysis: O(|V|) for the discovery numbers, the low links and the two stacks.
+ */
+int* strongly_connected_components(const Graph* g, size_t* num_components) {
+    size_t n = g->n;
+    size_t* number = safe_malloc((n > 0 ? n : 1) * sizeof *number);
+    size_t* low = safe_malloc((n > 0 ? n : 1) * sizeof *low);
+    bool* on_stack = safe_calloc(n > 0 ? n : 1, sizeof *on_stack);
+    size_t* stack = safe_malloc((n > 0 ? n : 1) * sizeof *stack);
+    SearchFrame* frames = safe_malloc((n > 0 ? n : 1) * sizeof *frames);
+    int* components = safe_malloc((n > 0 ? n : 1) * sizeof *components);
+    for (size_t v = 0; v < n; v++) {
+        number[v] = UNVISITED;
+    }
+    size_t next_number = 0, stack_len = 0, count = 0;
+    for (size_t root = 0; root < n; root++) {
+        if (number[root] != UNVISITED) continue;
+        size_t depth = 0;
+        frames[depth++] = (SearchFrame){ root, g->vertices[root].neighbors };
+        number[root] = low[root] = next_number++;
+        stack[stack_len++] = root;
+        on_stack[root] = true;
+        while (depth > 0) {
+            SearchFrame* top = &frames[depth - 1];
+            size_t v = top->v;
+            if (top->next_edge != NULL) {
+                size_t u = top->next_edge->v - g->vertices;
+                top->next_edge = top->next_edge->next;
+                if (number[u] == UNVISITED) {
+                    /* The recursive call. */
+                    frames[depth++] = (SearchFrame){ u, g->vertices[u].neighbors };
+                    number[u] = low[u] = next_number++;
+                    stack[stack_len++] = u;
+                    on_stack[u] = true;
+                } else if (on_stack[u] && number[u] < low[v]) {
+                    low[v] = number[u];
+                }
+                continue;
+            }
+            /* All of v's edges have been followed, so return from it. */
+            depth--;
+            if (low[v] == number[v]) {
+                size_t u;
+                do {
+                    u = stack[--stack_len];
+                    on_stack[u] = false;
+                    components[u] = (int)count;
+                } while (u != v);
+                count++;
+            }
+            if (depth > 0 && low[v] < low[frames[depth - 1].v]) {
+                low[frames[depth - 1].v] = low[v];
+            }
+        }
+    }
+    /* Reverse the numbering, so that it is a topological order. */
+    for (size_t v = 0; v < n; v++) {
+        components[v] = (int)count - 1 - components[v];
+    }
+    free(number);
+    free(low);
+    free(on_stack);
+    free(stack);
+    free(frames);
+    *num_components = count;
+    return components;
+}
+
+
+/* Return the condensation of a directed graph: the graph with a vertex for each of its
+ * `num_components` strongly connected components, as numbered by strongly_connected_components,
+ * and an edge between two components if there is an edge from a vertex in the first to a vertex in
+ * the second. The condensation has no cycles, and has no parallel edges.
+ *
+ *   Idea: Group the vertices by component with distribution counting. Then, for each component,
+ *   follow the edges of each of its vertices, and add an edge to the other end's component unless
+ *   it is the component itself or already has an edge from this one, which is tracked by marking
+ *   each target component with the last component that added an edge to it.
+ *
+ *   Time analysis: O(|V| + |E|).
+ *
+ *   Space analysis: O(|V|) for the grouping and the marks, besides the condensation.
+ */
+Graph* condensation(const Graph* g, const int components[], size_t num_components) {
+    size_t n = g->n;
+    size_t* starts = safe_calloc(num_components + 1, sizeof *starts);
+    size_t* by_component = safe_malloc((n > 0 ? n : 1) * sizeof *by_component);
+    for (size_t v = 0; v < n; v++) {
+        starts[components[v] + 1]++;
+    }
+    for (size_t c = 0; c < num_components; c++) {
+        starts[c + 1] += starts[c];
+    }
+    for (size_t v = 0; v < n; v++) {
+        by_component[starts[components[v]]++] = v;
+    }
+    /* Filling by_component moved each start to the start of the next component. */
+    for (size_t c = num_components; c > 0; c--) {
+        starts[c] = starts[c - 1];
+    }
+    starts[0] = 0;
+
+    Graph* ret = graph_new(num_components);
+    size_t* marks = safe_malloc((num_components > 0 ? num_components : 1) * sizeof *marks);
+    for (size_t c = 0; c < num_components; c++) {
+        marks[c] = SIZE_MAX;
+    }
+    for (size_t c = 0; c < num_components; c++) {
+        marks[c] = c;
+        for (size_t i = starts[c]; i < starts[c + 1]; i++) {
+            const Vertex* v = &g->vertices[by_component[i]];
+            for (VertexList* p = v->neighbors; p != NULL; p = p->next) {
+                size_t d = components[p->v - g->vertices];
+                if (marks[d] != c) {
+                    marks[d] = c;
+                    graph_add_edge_index(ret, c, d);
+                }
+            }
+        }
+    }
+    free(marks);
+    free(starts);
+    free(by_component);
+    return ret;
+}
+
+
 int ch04_tests() {
     puts("\n=== CHAPTER 4 TESTS ===");
     int tests_failed = 0;
@@ -126,6 +660,92 @@ int ch04_tests() {
     ASSERT(binary_search(bs_data, 5, 17) == 4);
     ASSERT(binary_search(bs_data, 5, 42) == -1);
 
+    /* INTERPOLATION SEARCH */
+    puts("Testing interpolation search");
+    for (size_t i = 0; i < 5; i++) {
+        ASSERT(interpolation_search(bs_data, 5, bs_data[i]) == (long long)i);
+    }
+    ASSERT(interpolation_search(bs_data, 5, 42) == -1);
+    ASSERT(interpolation_search(bs_data, 5, -8) == -1);
+    ASSERT(interpolation_search(bs_data, 5, 5) == -1);
+    ASSERT(interpolation_search(bs_data, 0, 5) == -1);
+    /* Keys that are far from evenly spread, with extreme values, and queries of every key and of
+     * the gaps around them.
+     */
+    size_t is_n = 2000;
+    int* is_data = safe_malloc(is_n * sizeof *is_data);
+    for (size_t i = 0; i < is_n; i++) {
+        is_data[i] = i < 1000 ? (int)i : (int)(1000 + (i - 1000) * (i - 1000) * 2000);
+    }
+    is_data[0] = -2147483647 - 1;
+    is_data[is_n - 1] = 2147483647;
+    int is_ok = 1;
+    for (size_t i = 0; i < is_n; i++) {
+        long long expected = binary_search(is_data, is_n, is_data[i]);
+        is_ok &= interpolation_search(is_data, is_n, is_data[i]) == expected;
+        if (is_data[i] < 2147483647 && (i + 1 == is_n || is_data[i] + 1 < is_data[i+1])) {
+            is_ok &= interpolation_search(is_data, is_n, is_data[i] + 1) == -1;
+        }
+    }
+    ASSERT(is_ok);
+    /* With duplicates, the first position is returned. */
+    int dup_data[] = {1, 3, 3, 3, 3, 3, 9};
+    ASSERT(interpolation_search(dup_data, 7, 3) == 1);
+    free(is_data);
+
+    /* SELECTION */
+    puts("Testing quickselect");
+    int qs_data[] = {4, 1, 10, 8, 7, 12, 9, 2, 15};
+    ASSERT(quickselect(qs_data, 9, 4) == 8);
+    ASSERT(quickselect(qs_data, 9, 0) == 1);
+    ASSERT(quickselect(qs_data, 9, 8) == 15);
+
+    puts("Testing nth element");
+    int nth_data[500], nth_sorted[500];
+    for (size_t i = 0; i < 500; i++) {
+        nth_sorted[i] = (int)((i * 7919) % 37);
+    }
+    i32_quicksort(nth_sorted, 500);
+    int nth_ok = 1;
+    for (size_t k = 0; k < 500; k += 7) {
+        for (size_t i = 0; i < 500; i++) {
+            nth_data[i] = (int)((i * 7919) % 37);
+        }
+        nth_element(nth_data, 500, k);
+        nth_ok &= nth_data[k] == nth_sorted[k];
+        for (size_t i = 0; i < 500; i++) {
+            if ((i < k && nth_data[i] > nth_data[k]) || (i > k && nth_data[i] < nth_data[k])) {
+                nth_ok = 0;
+            }
+        }
+    }
+    ASSERT(nth_ok);
+    /* A depth of 0 uses median of medians for every pivot. */
+    for (size_t i = 0; i < 500; i++) {
+        nth_data[i] = (int)(499 - i);
+    }
+    nth_element_helper(nth_data, 0, 499, 123, 0);
+    ASSERT(nth_data[123] == 123);
+
+    puts("Testing partial sort");
+    int ps_data[] = {9, -1, 8, 3, 3, 0, 7, 12, 5};
+    partial_sort(ps_data, 9, 4);
+    ASSERT(array_eq(4, ps_data, -1, 0, 3, 3));
+    partial_sort(ps_data, 9, 9);
+    ASSERT(is_sorted(ps_data, 9));
+
+    puts("Testing top k");
+    TopK* top = top_k_new(3);
+    int top_out[3];
+    top_k_push(top, 5);
+    top_k_push(top, 2);
+    ASSERT(top_k_result(top, top_out) == 2 && array_eq(2, top_out, 2, 5));
+    for (int i = 100; i >= -100; i -= 3) {
+        top_k_push(top, i);
+    }
+    ASSERT(top_k_result(top, top_out) == 3 && array_eq(3, top_out, -98, -95, -92));
+    top_k_free(top);
+
     /* TOPOLOGICAL SORTING */
     puts("Testing topological sorting");
     /* The graph from exercise 1a in section 4.2, page 142. */
@@ -136,5 +756,110 @@ int ch04_tests() {
     free(ranks);
     graph_free(g);
 
+    /* STRONGLY CONNECTED COMPONENTS */
+    puts("Testing strongly connected components");
+    g = graph_from_string(DIRECTED, "ABCDEFGH", "AB BC CA CD DE ED EF FF GH HG GA");
+    size_t num_components;
+    int* components = strongly_connected_components(g, &num_components);
+    /* Components in topological order: {G, H}, {A, B, C}, {D, E}, {F}. */
+    ASSERT(num_components == 4);
+    ASSERT(array_eq(8, components, 1, 1, 1, 2, 2, 3, 0, 0));
+    Graph* dag = condensation(g, components, num_components);
+    ranks = topological_sort(dag);
+    ASSERT(array_eq(4, ranks, 0, 1, 2, 3));
+    /* Each of the edges between components appears once. */
+    int dag_ok = 1;
+    for (size_t c = 0; c < dag->n; c++) {
+        size_t out_degree = 0;
+        for (VertexList* p = dag->vertices[c].neighbors; p != NULL; p = p->next) {
+            out_degree++;
+            dag_ok &= (size_t)(p->v - dag->vertices) == c + 1;
+        }
+        dag_ok &= out_degree == (c + 1 < dag->n ? 1 : 0);
+    }
+    ASSERT(dag_ok);
+    free(ranks);
+    free(components);
+    graph_free(dag);
+    graph_free(g);
+
+    /* A random graph, checked against reachability from its transitive closure. */
+    size_t scc_n = 200;
+    g = graph_new(scc_n);
+    unsigned int state = 11;
+    for (size_t e = 0; e < 260; e++) {
+        state = state * 1103515245 + 12345;
+        size_t from = (state >> 8) % scc_n;
+        state = state * 1103515245 + 12345;
+        graph_add_edge_index(g, from, (state >> 8) % scc_n);
+    }
+    components = strongly_connected_components(g, &num_components);
+    GraphMatrix* closure = graph_matrix_from_graph(g);
+    transitive_closure(closure);
+    int scc_ok = 1;
+    for (size_t i = 0; i < scc_n; i++) {
+        for (size_t j = 0; j < scc_n; j++) {
+            bool mutual = i == j
+                          || (MATRIX_HAS_EDGE(closure, i, j) && MATRIX_HAS_EDGE(closure, j, i));
+            scc_ok &= mutual == (components[i] == components[j]);
+        }
+        for (VertexList* p = g->vertices[i].neighbors; p != NULL; p = p->next) {
+            scc_ok &= components[i] <= components[p->v - g->vertices];
+        }
+    }
+    ASSERT(scc_ok);
+    free(components);
+    graph_matrix_free(closure);
+    graph_free(g);
+
+    /* DYNAMIC TOPOLOGICAL ORDER */
+    puts("Testing dynamic topological order");
+    /* Random insertions, checked against a cycle search from scratch (which, for the edges that
+     * are accepted, is also the order that they must respect).
+     */
+    size_t topo_n = 60;
+    TopologicalOrder* topo = topological_order_new(topo_n);
+    Graph* accepted = graph_new(topo_n);
+    int topo_ok = 1;
+    for (int e = 0; e < 400; e++) {
+        state = state * 1103515245 + 12345;
+        size_t from = (state >> 8) % topo_n;
+        state = state * 1103515245 + 12345;
+        size_t to = (state >> 8) % topo_n;
+        graph_add_edge_index(accepted, from, to);
+        components = strongly_connected_components(accepted, &num_components);
+        bool creates_cycle = from == to || num_components < topo_n;
+        free(components);
+        topo_ok &= topological_order_add_edge(topo, from, to) == !creates_cycle;
+        if (creates_cycle) {
+            /* Take the edge back out of the reference graph. */
+            VertexList* head = accepted->vertices[from].neighbors;
+            accepted->vertices[from].neighbors = head->next;
+            free(head);
+        }
+        for (size_t v = 0; v < topo_n; v++) {
+            topo_ok &= topo->vertex_at[topo->order[v]] == v;
+            for (VertexList* p = accepted->vertices[v].neighbors; p != NULL; p = p->next) {
+                topo_ok &= topo->order[v] < topo->order[p->v - accepted->vertices];
+            }
+        }
+    }
+    ASSERT(topo_ok);
+    graph_free(accepted);
+    topological_order_free(topo);
+
+    /* A cycle through a million vertices, which would overflow the call stack if the search were
+     * recursive.
+     */
+    size_t cycle_n = 1000000;
+    g = graph_new(cycle_n);
+    for (size_t v = 0; v < cycle_n; v++) {
+        graph_add_edge_index(g, v, (v + 1) % cycle_n);
+    }
+    components = strongly_connected_components(g, &num_components);
+    ASSERT(num_components == 1 && components[0] == 0 && components[cycle_n - 1] == 0);
+    free(components);
+    graph_free(g);
+
     return tests_failed;
 }
@@ -1,4 +1,8 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include "algorithms.h"
 
 
@@ -12,7 +16,12 @@
  *   Space analysis: A copy of the array must be made prior to merging, which takes O(n) space.
  */
 void merge_sort(int array[], size_t n) {
-    if (n >= 2) {
+    if (n <= SMALL_SORT_THRESHOLD) {
+        /* Below this size, the overhead of the copies and the calls outweighs the better
+         * asymptotic complexity, so use a sorting network instead.
+         */
+        small_sort(array, n);
+    } else {
         int* left = copy_array(array, 0, n/2);
         int* right = copy_array(array, n/2, n);
         merge_sort(left, n/2);
@@ -25,19 +34,41 @@ void merge_sort(int array[], size_t n) {
 
 
 /* Merge the sorted arrays `left` and `right`, into `target`, which must be at least as long as
- * `left` and `right` combined.
+ * `left` and `right` combined (and must not overlap with them).
+ *
+ * This uses the SIMD merge kernel (merge_avx2) when the CPU supports it and the arrays are large
+ * enough for it to pay off, and merge_branchless otherwise.
  */
 void merge(int left[], size_t left_len, int right[], size_t right_len, int target[]) {
+    if (left_len + right_len >= 2*SMALL_SORT_THRESHOLD && have_avx2()) {
+        merge_avx2(left, left_len, right, right_len, target);
+    } else {
+        merge_branchless(left, left_len, right, right_len, target);
+    }
+}
+
+
+/* The scalar version of merge.
+ *
+ *   Idea: Repeatedly take the smaller element from the fronts of the two arrays. On random data,
+ *   which array the next element comes from is unpredictable, so instead of branching on the
+ *   comparison, use it to select the element and to advance the two indices, which compiles to
+ *   conditional moves and additions.
+ *
+ *   Time analysis: O(left_len + right_len).
+ *
+ *   Space analysis: O(1).
+ */
+void merge_branchless(int left[], size_t left_len, int right[], size_t right_len, int target[]) {
     size_t left_index = 0, right_index = 0;
     while (left_index < left_len && right_index < right_len) {
-        /* Take the smaller element from the fronts of the two arrays. */
-        if (left[left_index] <= right[right_index]) {
-            target[left_index+right_index] = left[left_index];
-            left_index++;
-        } else {
-            target[left_index+right_index] = right[right_index];
-            right_index++;
-        }
+        int a = left[left_index];
+        int b = right[right_index];
+        /* Take from the right only if it is strictly smaller, so the merge is stable. */
+        bool take_right = b < a;
+        target[left_index+right_index] = take_right ? b : a;
+        right_index += take_right;
+        left_index += !take_right;
     }
     /* Take any remaining elements from the two arrays (since one array might be one element longer
      * than the other).
@@ -53,6 +84,930 @@ void merge(int left[], size_t left_len, int right[], size_t right_len, int targe
 }
 
 
+/* Runs shorter than this are extended with binary insertion sort before merging. */
+#define TIMSORT_MIN_MERGE 64
+/* How many elements in a row a merge must take from the same run before it switches to galloping
+ * mode.
+ */
+#define TIMSORT_MIN_GALLOP 7
+/* The run-length invariants make the lengths of the runs on the stack grow at least as fast as the
+ * Fibonacci numbers, so this is enough for any array that fits in memory.
+ */
+#define TIMSORT_MAX_RUNS 100
+
+
+typedef struct {
+    int* base;
+    size_t len;
+} TimsortRun;
+
+typedef struct {
+    TimsortRun runs[TIMSORT_MAX_RUNS];
+    size_t num_runs;
+    /* The current threshold for entering galloping mode. It goes down when galloping pays off and
+     * up when it does not.
+     */
+    size_t min_gallop;
+    int* tmp;
+    size_t tmp_len;
+} TimsortState;
+
+
+/* Return the first position in the sorted array `a` of length `n` where `key` could be inserted
+ * while keeping it sorted (i.e., the number of elements less than `key`).
+ *
+ *   Idea: Starting from `hint`, look at positions hint +/- 1, 3, 7, 15, ... until the key is
+ *   bracketed, and then binary search between the last two positions. This takes O(log d)
+ *   comparisons when the answer is at distance d from the hint, which beats a plain binary search
+ *   when the answer is close to the hint.
+ */
+static size_t gallop_left(int key, const int a[], size_t n, size_t hint) {
+    /* Invariant: a[lo] < key <= a[hi], where a[-1] = -infinity and a[n] = +infinity. */
+    long long lo, hi;
+    long long ofs = 1, last_ofs = 0;
+    if (a[hint] < key) {
+        long long max_ofs = n - hint;
+        while (ofs < max_ofs && a[hint + ofs] < key) {
+            last_ofs = ofs;
+            ofs = 2*ofs + 1;
+        }
+        if (ofs > max_ofs) ofs = max_ofs;
+        lo = hint + last_ofs;
+        hi = hint + ofs;
+    } else {
+        long long max_ofs = hint + 1;
+        while (ofs < max_ofs && !(a[hint - ofs] < key)) {
+            last_ofs = ofs;
+            ofs = 2*ofs + 1;
+        }
+        if (ofs > max_ofs) ofs = max_ofs;
+        lo = hint - ofs;
+        hi = hint - last_ofs;
+    }
+    lo++;
+    while (lo < hi) {
+        long long mid = lo + (hi - lo) / 2;
+        if (a[mid] < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return hi;
+}
+
+
+/* The same as gallop_left, except that it returns the last position where `key` could be inserted
+ * (i.e., the number of elements less than or equal to `key`).
+ */
+static size_t gallop_right(int key, const int a[], size_t n, size_t hint) {
+    /* Invariant: a[lo] <= key < a[hi]. */
+    long long lo, hi;
+    long long ofs = 1, last_ofs = 0;
+    if (key < a[hint]) {
+        long long max_ofs = hint + 1;
+        while (ofs < max_ofs && key < a[hint - ofs]) {
+            last_ofs = ofs;
+            ofs = 2*ofs + 1;
+        }
+        if (ofs > max_ofs) ofs = max_ofs;
+        lo = hint - ofs;
+        hi = hint - last_ofs;
+    } else {
+        long long max_ofs = n - hint;
+        while (ofs < max_ofs && !(key < a[hint + ofs])) {
+            last_ofs = ofs;
+            ofs = 2*ofs + 1;
+        }
+        if (ofs > max_ofs) ofs = max_ofs;
+        lo = hint + last_ofs;
+        hi = hint + ofs;
+    }
+    lo++;
+    while (lo < hi) {
+        long long mid = lo + (hi - lo) / 2;
+        if (key < a[mid]) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return hi;
+}
+
+
+static int* timsort_tmp(TimsortState* s, size_t n) {
+    if (s->tmp_len < n) {
+        s->tmp_len = n > 2*s->tmp_len ? n : 2*s->tmp_len;
+        s->tmp = safe_realloc(s->tmp, s->tmp_len * sizeof *s->tmp);
+    }
+    return s->tmp;
+}
+
+
+/* Merge the adjacent runs a[0...na-1] and b[0...nb-1] in place, where na <= nb, a[0] > b[0] and
+ * a[na-1] > b[nb-1]. Only the shorter run `a` is copied to the temporary buffer.
+ */
+static void timsort_merge_lo(TimsortState* s, int* a, size_t na, int* b, size_t nb) {
+    int* pa = timsort_tmp(s, na);
+    memcpy(pa, a, na * sizeof *a);
+    int* dest = a;
+    int* pb = b;
+    size_t min_gallop = s->min_gallop;
+    *dest++ = *pb++;
+    if (--nb == 0) goto done;
+    if (na == 1) goto copy_b;
+    while (1) {
+        /* Take one element at a time until one run starts winning consistently. */
+        size_t a_count = 0, b_count = 0;
+        while (1) {
+            if (*pb < *pa) {
+                *dest++ = *pb++;
+                b_count++;
+                a_count = 0;
+                if (--nb == 0) goto done;
+                if (b_count >= min_gallop) break;
+            } else {
+                *dest++ = *pa++;
+                a_count++;
+                b_count = 0;
+                if (--na == 1) goto copy_b;
+                if (a_count >= min_gallop) break;
+            }
+        }
+        /* Galloping mode: find how many elements in a row to take from each run with
+         * gallop_right/gallop_left and copy them in bulk, until that stops paying off.
+         */
+        min_gallop++;
+        do {
+            min_gallop -= min_gallop > 1;
+            s->min_gallop = min_gallop;
+            size_t k = gallop_right(*pb, pa, na, 0);
+            a_count = k;
+            if (k > 0) {
+                memcpy(dest, pa, k * sizeof *pa);
+                dest += k;
+                pa += k;
+                na -= k;
+                /* na cannot reach 0, since the last element of a is larger than all of b. */
+                if (na == 1) goto copy_b;
+            }
+            *dest++ = *pb++;
+            if (--nb == 0) goto done;
+            k = gallop_left(*pa, pb, nb, 0);
+            b_count = k;
+            if (k > 0) {
+                memmove(dest, pb, k * sizeof *pb);
+                dest += k;
+                pb += k;
+                nb -= k;
+                if (nb == 0) goto done;
+            }
+            *dest++ = *pa++;
+            if (--na == 1) goto copy_b;
+        } while (a_count >= TIMSORT_MIN_GALLOP || b_count >= TIMSORT_MIN_GALLOP);
+        min_gallop++;
+        s->min_gallop = min_gallop;
+    }
+done:
+    memcpy(dest, pa, na * sizeof *pa);
+    return;
+copy_b:
+    /* The one remaining element of a is larger than everything left in b. */
+    memmove(dest, pb, nb * sizeof *pb);
+    dest[nb] = *pa;
+}
+
+
+/* The mirror image of timsort_merge_lo, for when nb <= na. It merges from the right end, and only
+ * the shorter run `b` is copied to the temporary buffer.
+ */
+static void timsort_merge_hi(TimsortState* s, int* a, size_t na, int* b, size_t nb) {
+    int* tmp = timsort_tmp(s, nb);
+    memcpy(tmp, b, nb * sizeof *b);
+    int* dest = b + nb - 1;
+    int* pa = a + na - 1;
+    int* pb = tmp + nb - 1;
+    size_t min_gallop = s->min_gallop;
+    *dest-- = *pa--;
+    if (--na == 0) goto done;
+    if (nb == 1) goto copy_a;
+    while (1) {
+        size_t a_count = 0, b_count = 0;
+        while (1) {
+            /* On ties, b goes last, so that the merge is stable. */
+            if (*pb < *pa) {
+                *dest-- = *pa--;
+                a_count++;
+                b_count = 0;
+                if (--na == 0) goto done;
+                if (a_count >= min_gallop) break;
+            } else {
+                *dest-- = *pb--;
+                b_count++;
+                a_count = 0;
+                if (--nb == 1) goto copy_a;
+                if (b_count >= min_gallop) break;
+            }
+        }
+        min_gallop++;
+        do {
+            min_gallop -= min_gallop > 1;
+            s->min_gallop = min_gallop;
+            size_t k = na - gallop_right(*pb, pa - na + 1, na, na - 1);
+            a_count = k;
+            if (k > 0) {
+                dest -= k;
+                pa -= k;
+                memmove(dest + 1, pa + 1, k * sizeof *pa);
+                na -= k;
+                if (na == 0) goto done;
+            }
+            *dest-- = *pb--;
+            if (--nb == 1) goto copy_a;
+            k = nb - gallop_left(*pa, pb - nb + 1, nb, nb - 1);
+            b_count = k;
+            if (k > 0) {
+                dest -= k;
+                pb -= k;
+                memcpy(dest + 1, pb + 1, k * sizeof *pb);
+                nb -= k;
+                /* nb cannot reach 0, since the first element of b is smaller than all of a. */
+                if (nb == 1) goto copy_a;
+            }
+            *dest-- = *pa--;
+            if (--na == 0) goto done;
+        } while (a_count >= TIMSORT_MIN_GALLOP || b_count >= TIMSORT_MIN_GALLOP);
+        min_gallop++;
+        s->min_gallop = min_gallop;
+    }
+done:
+    memcpy(dest - nb + 1, pb - nb + 1, nb * sizeof *pb);
+    return;
+copy_a:
+    /* The one remaining element of b is smaller than everything left in a. */
+    dest -= na;
+    pa -= na;
+    memmove(dest + 1, pa + 1, na * sizeof *pa);
+    *dest = *pb;
+}
+
+
+/* Merge the i'th and (i+1)'th runs on the stack. */
+static void timsort_merge_at(TimsortState* s, size_t i) {
+    int* a = s->runs[i].base;
+    size_t na = s->runs[i].len;
+    int* b = s->runs[i+1].base;
+    size_t nb = s->runs[i+1].len;
+    s->runs[i].len = na + nb;
+    if (i + 3 == s->num_runs) {
+        s->runs[i+1] = s->runs[i+2];
+    }
+    s->num_runs--;
+    /* Elements at the start of a that are no larger than b[0] are already in place, and so are
+     * elements at the end of b that are no smaller than the last element of a.
+     */
+    size_t k = gallop_right(b[0], a, na, 0);
+    a += k;
+    na -= k;
+    if (na == 0) return;
+    nb = gallop_left(a[na-1], b, nb, nb - 1);
+    if (nb == 0) return;
+    if (na <= nb) {
+        timsort_merge_lo(s, a, na, b, nb);
+    } else {
+        timsort_merge_hi(s, a, na, b, nb);
+    }
+}
+
+
+/* Merge runs until the lengths of the runs on the stack satisfy, for the topmost runs X, Y, Z
+ * (with Z on top), len(X) > len(Y) + len(Z) and len(Y) > len(Z). This keeps the merges balanced
+ * and the stack short.
+ */
+static void timsort_merge_collapse(TimsortState* s) {
+    while (s->num_runs > 1) {
+        size_t k = s->num_runs - 2;
+        TimsortRun* r = s->runs;
+        if ((k > 0 && r[k-1].len <= r[k].len + r[k+1].len)
+                || (k > 1 && r[k-2].len <= r[k-1].len + r[k].len)) {
+            if (r[k-1].len < r[k+1].len) {
+                k--;
+            }
+        } else if (r[k].len > r[k+1].len) {
+            break;
+        }
+        timsort_merge_at(s, k);
+    }
+}
+
+
+/* Return the length of the run starting at array[0]. If the run is strictly descending, reverse
+ * it so that it is ascending. (It must be strictly descending, or reversing it could reorder
+ * equal elements.)
+ */
+static size_t timsort_count_run(int array[], size_t n) {
+    if (n == 1) return 1;
+    size_t len = 2;
+    if (array[1] < array[0]) {
+        while (len < n && array[len] < array[len-1]) {
+            len++;
+        }
+        for (size_t i = 0, j = len - 1; i < j; i++, j--) {
+            swap(array, i, j);
+        }
+    } else {
+        while (len < n && array[len] >= array[len-1]) {
+            len++;
+        }
+    }
+    return len;
+}
+
+
+/* Sort array[0...n-1], given that array[0...sorted-1] is already sorted, by inserting each
+ * remaining element after a binary search for its position. The search finds the position after
+ * any equal elements, so the sort is stable.
+ */
+static void binary_insertion_sort(int array[], size_t n, size_t sorted) {
+    for (size_t i = sorted; i < n; i++) {
+        int v = array[i];
+        size_t lo = 0, hi = i;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (v < array[mid]) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+        memmove(array + lo + 1, array + lo, (i - lo) * sizeof *array);
+        array[lo] = v;
+    }
+}
+
+
+/* Return a minimum run length between 32 and 64 such that n / min_run is equal to, or slightly
+ * less than, a power of two, so that the final merges are balanced.
+ */
+static size_t timsort_min_run(size_t n) {
+    size_t r = 0;
+    while (n >= TIMSORT_MIN_MERGE) {
+        r |= n & 1;
+        n >>= 1;
+    }
+    return n + r;
+}
+
+
+/* Sort the elements of `array` in ascending order. The sort is stable.
+ *
+ *   Idea: Scan the array from left to right for "runs" that are already ascending or strictly
+ *   descending (which are reversed). Runs shorter than a minimum length are extended with binary
+ *   insertion sort. Each run is pushed onto a stack, and runs on the stack are merged whenever
+ *   their lengths would violate an invariant that keeps merges between runs of similar size (see
+ *   timsort_merge_collapse). Merges first skip the parts of the runs that are already in place,
+ *   and when one run wins many comparisons in a row, they switch to "galloping" (see gallop_left)
+ *   to copy long stretches of that run at once. This is the algorithm used by Python's and Java's
+ *   standard library sorts.
+ *
+ *   Time analysis: O(n log n) in the worst case, like merge sort. On input made of r runs it is
+ *   O(n log r), so already sorted (or reverse sorted) input takes a single O(n) pass.
+ *
+ *   Space analysis: O(n) in the worst case for the merge buffer, but only as large as the shorter
+ *   run of each merge, so much less on partially ordered input.
+ */
+void timsort(int array[], size_t n) {
+    if (n < 2) return;
+    TimsortState s;
+    s.num_runs = 0;
+    s.min_gallop = TIMSORT_MIN_GALLOP;
+    s.tmp = NULL;
+    s.tmp_len = 0;
+    size_t min_run = timsort_min_run(n);
+    size_t remaining = n;
+    int* p = array;
+    while (remaining > 0) {
+        size_t len = timsort_count_run(p, remaining);
+        if (len < min_run) {
+            size_t forced = remaining < min_run ? remaining : min_run;
+            binary_insertion_sort(p, forced, len);
+            len = forced;
+        }
+        s.runs[s.num_runs].base = p;
+        s.runs[s.num_runs].len = len;
+        s.num_runs++;
+        timsort_merge_collapse(&s);
+        p += len;
+        remaining -= len;
+    }
+    /* Merge whatever is left on the stack. */
+    while (s.num_runs > 1) {
+        size_t k = s.num_runs - 2;
+        if (k > 0 && s.runs[k-1].len < s.runs[k+1].len) {
+            k--;
+        }
+        timsort_merge_at(&s, k);
+    }
+    free(s.tmp);
+}
+
+
+/* Reverse array[start...end-1]. */
+static void reverse_range(int array[], size_t start, size_t end) {
+    while (end - start >= 2) {
+        swap(array, start++, --end);
+    }
+}
+
+
+/* Swap the adjacent blocks array[start...mid-1] and array[mid...end-1]. If the smaller block fits
+ * in `buffer`, it is moved out of the way and back with memcpy; otherwise three reversals are used:
+ * reversing each block and then the whole range puts both blocks back in their original order.
+ */
+static void rotate(int array[], size_t start, size_t mid, size_t end, int buffer[],
+                   size_t buffer_len) {
+    size_t left_len = mid - start, right_len = end - mid;
+    if (left_len <= right_len && left_len <= buffer_len) {
+        memcpy(buffer, array + start, left_len * sizeof *array);
+        memmove(array + start, array + mid, right_len * sizeof *array);
+        memcpy(array + start + right_len, buffer, left_len * sizeof *array);
+    } else if (right_len <= buffer_len) {
+        memcpy(buffer, array + mid, right_len * sizeof *array);
+        memmove(array + start + right_len, array + start, left_len * sizeof *array);
+        memcpy(array + start, buffer, right_len * sizeof *array);
+    } else {
+        reverse_range(array, start, mid);
+        reverse_range(array, mid, end);
+        reverse_range(array, start, end);
+    }
+}
+
+
+/* Swap array[i...i+len-1] with array[j...j+len-1]. The two ranges must not overlap. */
+static void swap_ranges(int array[], size_t i, size_t j, size_t len) {
+    for (size_t t = 0; t < len; t++) {
+        int v = array[i+t];
+        array[i+t] = array[j+t];
+        array[j+t] = v;
+    }
+}
+
+
+/* Stably merge the adjacent sorted ranges array[start...mid-1] and array[mid...end-1], the
+ * shorter of which must fit in `buffer`: copy it there and merge normally, from the front or from
+ * the back so that the output never overwrites unread elements.
+ */
+static void merge_with_buffer(int array[], size_t start, size_t mid, size_t end, int buffer[]) {
+    size_t left_len = mid - start, right_len = end - mid;
+    if (left_len <= right_len) {
+        memcpy(buffer, array + start, left_len * sizeof *array);
+        size_t i = 0, j = mid, k = start;
+        while (i < left_len && j < end) {
+            bool take_right = array[j] < buffer[i];
+            array[k++] = take_right ? array[j] : buffer[i];
+            j += take_right;
+            i += !take_right;
+        }
+        memcpy(array + k, buffer + i, (left_len - i) * sizeof *array);
+    } else {
+        memcpy(buffer, array + mid, right_len * sizeof *array);
+        size_t i = mid, j = right_len, k = end;
+        while (i > start && j > 0) {
+            /* Take from the left only if it is strictly larger, so the merge is stable. */
+            bool take_left = buffer[j-1] < array[i-1];
+            array[--k] = take_left ? array[i-1] : buffer[j-1];
+            i -= take_left;
+            j -= !take_left;
+        }
+        memcpy(array + start, buffer, j * sizeof *array);
+    }
+}
+
+
+/* The same as merge_with_buffer, except that the buffer is array[internal...], a range of the
+ * array itself outside of the two being merged. The shorter range is swapped into it instead of
+ * copied, and the merge swaps each element into its place, so that afterwards the buffer holds
+ * its own elements again, in some other order.
+ */
+static void merge_internal(int array[], size_t start, size_t mid, size_t end, size_t internal) {
+    size_t left_len = mid - start, right_len = end - mid;
+    if (left_len <= right_len) {
+        swap_ranges(array, start, internal, left_len);
+        size_t i = internal, j = mid, k = start;
+        while (i < internal + left_len && j < end) {
+            bool take_right = array[j] < array[i];
+            size_t from = take_right ? j : i;
+            j += take_right;
+            i += !take_right;
+            int v = array[k];
+            array[k++] = array[from];
+            array[from] = v;
+        }
+        swap_ranges(array, k, i, internal + left_len - i);
+    } else {
+        swap_ranges(array, mid, internal, right_len);
+        size_t i = mid, j = internal + right_len, k = end;
+        while (i > start && j > internal) {
+            /* Take from the left only if it is strictly larger, so the merge is stable. */
+            bool take_left = array[j-1] < array[i-1];
+            i -= take_left;
+            j -= !take_left;
+            size_t from = take_left ? i : j;
+            int v = array[--k];
+            array[k] = array[from];
+            array[from] = v;
+        }
+        swap_ranges(array, start, internal, j - internal);
+    }
+}
+
+
+/* The most blocks that block_merge splits the left range into, so that their order fits in two
+ * tables on the stack.
+ */
+#define BLOCK_MERGE_MAX_BLOCKS 8192
+
+/* The length of the internal buffer that merge_sort_in_place_buffer sets aside to sort n elements:
+ * enough for a block of any merge it makes, which block_merge makes at most
+ * max(sqrt(end - start), (mid - start) / BLOCK_MERGE_MAX_BLOCKS) long.
+ */
+static size_t internal_buffer_len(size_t n) {
+    size_t len = (size_t)ceil(sqrt((double)n));
+    size_t min_len = (n + BLOCK_MERGE_MAX_BLOCKS - 1) / BLOCK_MERGE_MAX_BLOCKS;
+    return len > min_len ? len : min_len;
+}
+
+
+/* Stably merge the adjacent sorted ranges array[start...mid-1] (A) and array[mid...end-1] (B)
+ * with the help of the internal buffer array[internal...internal+internal_len-1] (see
+ * merge_internal) and `buffer`.
+ *
+ *   Idea: Small merges are done directly with whichever buffer fits the shorter range. Otherwise,
+ *   split A and B into blocks of about sqrt(end - start) elements, and tag each A block with its
+ *   position in A in a table on the stack (the first block of A is whatever is left over and is
+ *   not tagged). Then walk through B, a block at a time, rolling the A blocks along behind it:
+ *   each B block is swapped with the first A block, so that the A blocks stay together but are
+ *   shuffled. Whenever the last element of the last B block rolled past is not less than the
+ *   first element of the smallest A block (found with the tags), that A block is dropped behind
+ *   instead: it is swapped to the front of the A blocks and rotated in front of the B elements
+ *   that must follow it. This puts the blocks in order of their first elements, which is the
+ *   selection sort at the heart of block merge sort, and leaves only local merges to do: each
+ *   dropped A block is merged with the B elements between it and the next one, and since it is
+ *   only a block long, it fits in the internal buffer.
+ *
+ *   Time analysis: O(end - start). Every element takes part in a constant number of block swaps,
+ *   rotations and local merges, and the tags find each A block in O(1) instead of searching for it.
+ *
+ *   Space analysis: O(1), for two tables of BLOCK_MERGE_MAX_BLOCKS tags. When A has more than
+ *   BLOCK_MERGE_MAX_BLOCKS blocks of sqrt(end - start), the blocks are made longer instead.
+ */
+static void block_merge(int array[], size_t start, size_t mid, size_t end, size_t internal,
+                        size_t internal_len, int buffer[], size_t buffer_len) {
+    size_t left_len = mid - start, right_len = end - mid;
+    if (left_len == 0 || right_len == 0 || array[mid-1] <= array[mid]) {
+        /* Already in order. */
+        return;
+    }
+    size_t shorter = left_len < right_len ? left_len : right_len;
+    if (shorter <= buffer_len) {
+        merge_with_buffer(array, start, mid, end, buffer);
+        return;
+    }
+    if (shorter <= internal_len) {
+        merge_internal(array, start, mid, end, internal);
+        return;
+    }
+
+    size_t block_len = (size_t)ceil(sqrt((double)(end - start)));
+    if (block_len < (left_len + BLOCK_MERGE_MAX_BLOCKS - 1) / BLOCK_MERGE_MAX_BLOCKS) {
+        block_len = (left_len + BLOCK_MERGE_MAX_BLOCKS - 1) / BLOCK_MERGE_MAX_BLOCKS;
+    }
+    /* The A blocks form a circular queue, in which slots[q] is the tag of the block q places after
+     * the first one (modulo the table size), and positions[t] is the place of the block tagged t.
+     */
+    uint16_t slots[BLOCK_MERGE_MAX_BLOCKS], positions[BLOCK_MERGE_MAX_BLOCKS];
+    const size_t mask = BLOCK_MERGE_MAX_BLOCKS - 1;
+    size_t num_blocks = left_len / block_len;
+    for (size_t t = 0; t < num_blocks; t++) {
+        slots[t] = positions[t] = (uint16_t)t;
+    }
+    size_t head = 0, next_tag = 0;
+    /* The A blocks still to be dropped, the last A block dropped (to be merged with the B elements
+     * after it), the last B block rolled past, and the next B block.
+     */
+    size_t a_start = start + left_len % block_len, a_end = mid;
+    size_t last_a = start, last_a_end = a_start;
+    size_t last_b = a_start, last_b_end = a_start;
+    size_t b_start = mid, b_end = mid + block_len < end ? mid + block_len : end;
+    while (a_start < a_end) {
+        size_t min_a = a_start + ((positions[next_tag] - head) & mask) * block_len;
+        if ((last_b < last_b_end && array[last_b_end-1] >= array[min_a]) || b_start == b_end) {
+            /* Drop the smallest A block before the B elements that are not less than its first. */
+            size_t split = last_b < last_b_end
+                ? last_b + gallop_left(array[min_a], array + last_b, last_b_end - last_b, 0)
+                : last_b;
+            if (min_a != a_start) {
+                swap_ranges(array, a_start, min_a, block_len);
+                slots[positions[next_tag]] = slots[head];
+                positions[slots[head]] = positions[next_tag];
+            }
+            head = (head + 1) & mask;
+            next_tag++;
+            rotate(array, split, a_start, a_start + block_len, buffer, buffer_len);
+            block_merge(array, last_a, last_a_end, split, internal, internal_len, buffer,
+                        buffer_len);
+            last_a = split;
+            last_a_end = split + block_len;
+            last_b = last_a_end;
+            last_b_end = a_start + block_len;
+            a_start += block_len;
+        } else if (b_end - b_start < block_len) {
+            /* The last B block is short, so rotate it in front of the A blocks instead. */
+            rotate(array, a_start, b_start, b_end, buffer, buffer_len);
+            last_b = a_start;
+            last_b_end = a_start + (b_end - b_start);
+            a_start = last_b_end;
+            a_end = b_end;
+            b_start = b_end;
+        } else {
+            /* Roll the A blocks past the next B block. */
+            swap_ranges(array, a_start, b_start, block_len);
+            size_t back = (head + (a_end - a_start) / block_len) & mask;
+            slots[back] = slots[head];
+            positions[slots[head]] = (uint16_t)back;
+            head = (head + 1) & mask;
+            last_b = a_start;
+            last_b_end = a_start + block_len;
+            a_start += block_len;
+            a_end += block_len;
+            b_start = a_end;
+            b_end = b_start + block_len < end ? b_start + block_len : end;
+        }
+    }
+    block_merge(array, last_a, last_a_end, end, internal, internal_len, buffer, buffer_len);
+}
+
+
+/* Stably merge the adjacent sorted ranges array[start...mid-1] and array[mid...end-1], where the
+ * right range is much shorter, using only rotations.
+ *
+ *   Idea: Rotate the right range in front of the elements of the left range that are greater than
+ *   its last element, which puts them in their final place, and then leave the elements of the
+ *   right range that are not less than the new last element of the left range where they are,
+ *   which puts them in their final place too. Repeat with what is left.
+ *
+ *   Time analysis: O(n + m^2) moves and O(m log n) comparisons for ranges of length n and m, since
+ *   every rotation moves the right range once and puts at least one of its elements in place.
+ *
+ *   Space analysis: O(1).
+ */
+static void merge_short_right(int array[], size_t start, size_t mid, size_t end, int buffer[],
+                              size_t buffer_len) {
+    while (start < mid && mid < end) {
+        size_t split = start + gallop_right(array[end-1], array + start, mid - start,
+                                            mid - start - 1);
+        rotate(array, split, mid, end, buffer, buffer_len);
+        end -= mid - split;
+        mid = split;
+        if (start < mid) {
+            end = mid + gallop_left(array[mid-1], array + mid, end - mid, end - mid - 1);
+        }
+    }
+}
+
+
+/* Sort the elements of `array` in ascending order, stably and without allocating memory, using
+ * `buffer` (of `buffer_len` elements, which may be 0) as scratch space for small merges.
+ *
+ *   Idea: Block merge sort. Set aside the last internal_buffer_len(n), or about sqrt(n), elements
+ *   as an internal buffer, and sort the rest with a bottom-up merge sort: sort blocks of
+ *   SMALL_SORT_THRESHOLD elements with binary insertion sort, then merge adjacent blocks of width
+ *   32, 64, 128, ... with block_merge, which uses the internal buffer to merge in linear time.
+ *   Finally, sort the internal buffer the same way and merge it into the rest with rotations.
+ *
+ *   Time analysis: O(n log n), since block_merge takes linear time and the final merge takes
+ *   O(n + (sqrt n)^2). Every merge moves each element several times, with swaps and rotations
+ *   instead of copies, so it is a constant factor slower than an ordinary merge sort, but the
+ *   factor does not grow with n.
+ *
+ *   Space analysis: O(1) besides the buffer, for block_merge's tables.
+ */
+void merge_sort_in_place_buffer(int array[], size_t n, int buffer[], size_t buffer_len) {
+    if (n <= SMALL_SORT_THRESHOLD) {
+        binary_insertion_sort(array, n, 1);
+        return;
+    }
+    size_t internal_len = internal_buffer_len(n);
+    size_t len = n - internal_len;
+    for (size_t start = 0; start < len; start += SMALL_SORT_THRESHOLD) {
+        size_t block = len - start < SMALL_SORT_THRESHOLD ? len - start : SMALL_SORT_THRESHOLD;
+        binary_insertion_sort(array + start, block, 1);
+    }
+    for (size_t width = SMALL_SORT_THRESHOLD; width < len; width *= 2) {
+        for (size_t start = 0; start + width < len; start += 2*width) {
+            size_t end = len - start < 2*width ? len : start + 2*width;
+            block_merge(array, start, start + width, end, len, internal_len, buffer, buffer_len);
+        }
+    }
+    merge_sort_in_place_buffer(array + len, internal_len, buffer, buffer_len);
+    merge_short_right(array, 0, len, n, buffer, buffer_len);
+}
+
+
+#define IN_PLACE_BUFFER_LEN 512
+
+/* Sort the elements of `array` in ascending order, stably and with O(1) extra memory. This is
+ * merge_sort_in_place_buffer with a fixed buffer on the stack, so memory use does not grow with n.
+ */
+void merge_sort_in_place(int array[], size_t n) {
+    int buffer[IN_PLACE_BUFFER_LEN];
+    merge_sort_in_place_buffer(array, n, buffer, IN_PLACE_BUFFER_LEN);
+}
+
+
+/* A tournament tree used to merge k sorted sequences. Each leaf is the current head of one
+ * sequence, and each internal node stores the *loser* of the match played there, so that the
+ * overall winner (the smallest head) is at tree[0].
+ */
+typedef struct {
+    size_t k;
+    /* tree[0] is the winner, and tree[1...k-1] are the losers at the internal nodes. The leaf for
+     * sequence i is (conceptually) at node k+i.
+     */
+    size_t* tree;
+    /* The current head of each sequence, and whether the sequence is exhausted. */
+    int* keys;
+    bool* done;
+} LoserTree;
+
+
+/* Return true if the head of sequence a should be output before the head of sequence b. Ties are
+ * broken by sequence number, so the merge is stable.
+ */
+static bool loser_tree_beats(const LoserTree* t, size_t a, size_t b) {
+    if (t->done[a] || t->done[b]) {
+        return !t->done[a] && (t->done[b] || a < b);
+    }
+    return t->keys[a] < t->keys[b] || (t->keys[a] == t->keys[b] && a < b);
+}
+
+
+static void loser_tree_init(LoserTree* t, size_t k) {
+    t->k = k;
+    t->tree = safe_malloc(k * sizeof *t->tree);
+    t->keys = safe_malloc(k * sizeof *t->keys);
+    t->done = safe_malloc(k * sizeof *t->done);
+}
+
+
+static void loser_tree_free(LoserTree* t) {
+    free(t->tree);
+    free(t->keys);
+    free(t->done);
+}
+
+
+/* Play every match, once the keys and done flags of all the leaves have been set. */
+static void loser_tree_build(LoserTree* t) {
+    size_t k = t->k;
+    if (k == 1) {
+        t->tree[0] = 0;
+        return;
+    }
+    /* winners[i] is the winner of the subtree rooted at internal node i. */
+    size_t* winners = safe_malloc(k * sizeof *winners);
+    for (size_t node = k - 1; node >= 1; node--) {
+        size_t left = 2*node >= k ? 2*node - k : winners[2*node];
+        size_t right = 2*node + 1 >= k ? 2*node + 1 - k : winners[2*node + 1];
+        if (loser_tree_beats(t, right, left)) {
+            winners[node] = right;
+            t->tree[node] = left;
+        } else {
+            winners[node] = left;
+            t->tree[node] = right;
+        }
+    }
+    t->tree[0] = winners[1];
+    free(winners);
+}
+
+
+/* Replay the matches on the path from the winner's leaf to the root, after its key has changed. */
+static void loser_tree_replay(LoserTree* t) {
+    size_t winner = t->tree[0];
+    for (size_t node = (winner + t->k) / 2; node >= 1; node /= 2) {
+        if (loser_tree_beats(t, t->tree[node], winner)) {
+            size_t tmp = t->tree[node];
+            t->tree[node] = winner;
+            winner = tmp;
+        }
+    }
+    t->tree[0] = winner;
+}
+
+
+/* Merge the `k` sorted arrays `runs[0...k-1]`, where runs[i] has length lens[i], into `target`,
+ * which must be at least as long as all the runs combined. Elements that compare equal are output
+ * in the order of the runs they came from.
+ *
+ *   Idea: Keep the head of each run in a loser tree. The smallest head is at the root; output it,
+ *   replace it with the next element from the same run, and replay the matches on the path from
+ *   that run's leaf back up to the root.
+ *
+ *   Time analysis: The tree is built with k-1 comparisons, and each output element costs one
+ *   comparison per level of the tree, so O(n log k) for n elements in total. Unlike a binary heap,
+ *   which compares against both children at each level, a loser tree only compares against the
+ *   stored loser, and always along the same leaf-to-root path.
+ *
+ *   Space analysis: O(k).
+ */
+void kway_merge(int* runs[], const size_t lens[], size_t k, int target[]) {
+    if (k == 0) return;
+    LoserTree t;
+    loser_tree_init(&t, k);
+    size_t* positions = safe_calloc(k, sizeof *positions);
+    for (size_t i = 0; i < k; i++) {
+        t.done[i] = lens[i] == 0;
+        t.keys[i] = t.done[i] ? 0 : runs[i][0];
+    }
+    loser_tree_build(&t);
+    size_t out = 0;
+    while (!t.done[t.tree[0]]) {
+        size_t w = t.tree[0];
+        target[out++] = t.keys[w];
+        if (++positions[w] < lens[w]) {
+            t.keys[w] = runs[w][positions[w]];
+        } else {
+            t.done[w] = true;
+        }
+        loser_tree_replay(&t);
+    }
+    free(positions);
+    loser_tree_free(&t);
+}
+
+
+/* Merge `k` sorted streams into one sorted stream, without holding any of them fully in memory.
+ *
+ * Each input stream i is read by calling `source(sources[i], buffer, block_len)`, which should
+ * fill `buffer` with up to `block_len` of the stream's next elements and return how many it wrote,
+ * or 0 at the end of the stream. The merged output is passed to `sink(sink_context, block, len)`
+ * in blocks of `block_len` elements (the last block may be shorter).
+ *
+ *   Idea: The same as kway_merge, except that each stream has a buffer of `block_len` elements
+ *   that is refilled from the source when it runs out.
+ *
+ *   Time analysis: O(n log k), the same as kway_merge.
+ *
+ *   Space analysis: O((k + 1) * block_len) for the input buffers and the output block.
+ */
+void kway_merge_stream(kway_source_f* source, void* sources[], size_t k, kway_sink_f* sink,
+                       void* sink_context, size_t block_len) {
+    if (k == 0 || block_len == 0) return;
+    LoserTree t;
+    loser_tree_init(&t, k);
+    int* buffers = safe_malloc((k + 1) * block_len * sizeof *buffers);
+    int* output = buffers + k * block_len;
+    size_t* positions = safe_calloc(k, sizeof *positions);
+    size_t* lens = safe_malloc(k * sizeof *lens);
+    for (size_t i = 0; i < k; i++) {
+        lens[i] = source(sources[i], buffers + i * block_len, block_len);
+        t.done[i] = lens[i] == 0;
+        t.keys[i] = t.done[i] ? 0 : buffers[i * block_len];
+    }
+    loser_tree_build(&t);
+    size_t out = 0;
+    while (!t.done[t.tree[0]]) {
+        size_t w = t.tree[0];
+        output[out++] = t.keys[w];
+        if (out == block_len) {
+            sink(sink_context, output, out);
+            out = 0;
+        }
+        int* buffer = buffers + w * block_len;
+        if (++positions[w] == lens[w]) {
+            /* Refill the buffer once every element in it has been output. */
+            lens[w] = source(sources[w], buffer, block_len);
+            positions[w] = 0;
+        }
+        if (lens[w] == 0) {
+            t.done[w] = true;
+        } else {
+            t.keys[w] = buffer[positions[w]];
+        }
+        loser_tree_replay(&t);
+    }
+    if (out > 0) {
+        sink(sink_context, output, out);
+    }
+    free(positions);
+    free(lens);
+    free(buffers);
+    loser_tree_free(&t);
+}
+
+
 /* Sort the elements of `array` in ascending order.
  *
  *   Idea: Pick an arbitrary element, called the pivot. Put all smaller elements before the pivot
@@ -74,7 +1029,12 @@ void quicksort(int array[], size_t n) {
 }
 
 void quicksort_helper(int array[], size_t start, size_t end) {
-    if (start < end) {
+    if (end - start + 1 <= SMALL_SORT_THRESHOLD) {
+        /* As in merge sort, use a sorting network for small subarrays. (This also handles an empty
+         * array, where end = start - 1.)
+         */
+        small_sort(array + start, end - start + 1);
+    } else {
         size_t s = partition(array, start, end);
         quicksort_helper(array, start, s);
         quicksort_helper(array, s+1, end);
@@ -105,8 +1065,219 @@ size_t partition(int array[], size_t start, size_t end) {
 }
 
 
-/* Given the two lists of the same set of unique points, one in ascending order of the x-coordinate
- * and the other in ascending order of the y-coordinate, return the distance between the two closest
+/* Compare points by one coordinate, for the presorts of closest_pair_parallel. */
+#define LESS_X(p, q) ((p).x < (q).x)
+#define LESS_Y(p, q) ((p).y < (q).y)
+
+SORTING_DEFINE_STATIC(point_x, Point, LESS_X)
+SORTING_DEFINE_STATIC(point_y, Point, LESS_Y)
+
+
+/* Below this many points, closest_pair_helper does not fork any more threads. */
+#define CLOSEST_PAIR_GRAIN (1 << 14)
+/* Below this many points, the strip is scanned by a single thread. */
+#define CLOSEST_PAIR_STRIP_GRAIN (1 << 16)
+
+
+/* One thread's share of the points near the median in closest_pair_helper. */
+typedef struct {
+    /* The points sorted by y, and this thread's range of them. */
+    const Point* sorted_by_y;
+    size_t start, end;
+    /* The strip of points near the median, and this thread's range of it. */
+    Point* strip;
+    size_t strip_len, strip_start, strip_end;
+    double median, best_sq;
+} StripTask;
+
+static void* strip_count(void* arg) {
+    StripTask* t = arg;
+    t->strip_end = 0;
+    for (size_t i = t->start; i < t->end; i++) {
+        double dx = t->sorted_by_y[i].x - t->median;
+        t->strip_end += dx*dx < t->best_sq;
+    }
+    return NULL;
+}
+
+static void* strip_fill(void* arg) {
+    StripTask* t = arg;
+    size_t k = t->strip_start;
+    for (size_t i = t->start; i < t->end; i++) {
+        double dx = t->sorted_by_y[i].x - t->median;
+        if (dx*dx < t->best_sq) {
+            t->strip[k++] = t->sorted_by_y[i];
+        }
+    }
+    return NULL;
+}
+
+/* Compare each point in this thread's range of the strip to the points above it. This looks like a
+ * quadratic loop, but it's really not! It can be shown using the pigeonhole principle that the
+ * inner loop is bounded by a constant. The inner loop may run past the end of the range, but only
+ * to read the strip, which no thread is writing by then.
+ */
+static void* strip_scan(void* arg) {
+    StripTask* t = arg;
+    const Point* strip = t->strip;
+    for (size_t i = t->strip_start; i < t->strip_end; i++) {
+        for (size_t k = i + 1; k < t->strip_len; k++) {
+            double dy = strip[k].y - strip[i].y;
+            if (dy*dy >= t->best_sq) {
+                break;
+            }
+            double d_sq = distance_squared(strip[i], strip[k]);
+            if (d_sq < t->best_sq) {
+                t->best_sq = d_sq;
+            }
+        }
+    }
+    return NULL;
+}
+
+
+/* Return the smallest squared distance between a point in the strip of points in `sorted_by_y`
+ * whose squared distance from the line x = median is less than best_sq, and any other point of the
+ * strip, or best_sq if there is no closer pair. The strip is built in `scratch`, and both steps are
+ * split across `num_threads` threads.
+ */
+static double closest_in_strip(const Point sorted_by_y[], size_t n, double median, double best_sq,
+                               Point scratch[], int num_threads) {
+    StripTask one_task;
+    StripTask* tasks = &one_task;
+    if (n < CLOSEST_PAIR_STRIP_GRAIN) {
+        num_threads = 1;
+    } else if (num_threads > 1) {
+        tasks = safe_malloc(num_threads * sizeof *tasks);
+    }
+    for (int i = 0; i < num_threads; i++) {
+        tasks[i].sorted_by_y = sorted_by_y;
+        tasks[i].start = n * i / num_threads;
+        tasks[i].end = n * (i + 1) / num_threads;
+        tasks[i].strip = scratch;
+        tasks[i].median = median;
+        tasks[i].best_sq = best_sq;
+    }
+    /* Count each thread's points in the strip, so that they can all be copied into it at once. */
+    run_in_parallel(strip_count, tasks, sizeof *tasks, num_threads);
+    size_t strip_len = 0;
+    for (int i = 0; i < num_threads; i++) {
+        size_t count = tasks[i].strip_end;
+        tasks[i].strip_start = strip_len;
+        strip_len += count;
+        tasks[i].strip_end = strip_len;
+    }
+    for (int i = 0; i < num_threads; i++) {
+        tasks[i].strip_len = strip_len;
+    }
+    run_in_parallel(strip_fill, tasks, sizeof *tasks, num_threads);
+    run_in_parallel(strip_scan, tasks, sizeof *tasks, num_threads);
+    for (int i = 0; i < num_threads; i++) {
+        if (tasks[i].best_sq < best_sq) {
+            best_sq = tasks[i].best_sq;
+        }
+    }
+    if (tasks != &one_task) {
+        free(tasks);
+    }
+    return best_sq;
+}
+
+
+/* The arguments and result of closest_pair_helper, so that it can be run on a thread. */
+typedef struct {
+    Point* sorted_by_x;
+    Point* sorted_by_y;
+    Point* scratch;
+    size_t n;
+    int num_threads;
+    double best_sq;
+} ClosestPairTask;
+
+static void* closest_pair_task(void* arg);
+
+/* Return the squared distance between the two closest points in `sorted_by_x` and `sorted_by_y`,
+ * using up to `num_threads` threads. `scratch` must have room for n points. On return,
+ * `sorted_by_y` is unchanged, but points with the same x-coordinate may have been reordered in
+ * `sorted_by_x` and `scratch` has been overwritten.
+ */
+static double closest_pair_helper(Point sorted_by_x[], Point sorted_by_y[], Point scratch[],
+                                  size_t n, int num_threads) {
+    if (n <= 3) {
+        double best_sq = INFINITY;
+        for (size_t i = 0; i < n; i++) {
+            for (size_t j = i + 1; j < n; j++) {
+                best_sq = fmin(best_sq, distance_squared(sorted_by_x[i], sorted_by_x[j]));
+            }
+        }
+        return best_sq;
+    }
+
+    size_t left_n = n - n / 2;
+    double median = sorted_by_x[left_n - 1].x;
+    /* Split the points sorted by y into the left half and the right half, in `scratch`. Points on
+     * the median line could go either way, so the first of them in order of y go to the left until
+     * it is full, and they are rewritten into `sorted_by_x` in the same order so that both lists
+     * agree on which half every point is in.
+     */
+    size_t ties_start = left_n - 1;
+    while (ties_start > 0 && sorted_by_x[ties_start - 1].x == median) {
+        ties_start--;
+    }
+    size_t left_ties = left_n - ties_start;
+    size_t left_i = 0, right_i = left_n, ties = 0;
+    for (size_t i = 0; i < n; i++) {
+        Point p = sorted_by_y[i];
+        bool left = p.x < median || (p.x == median && ties < left_ties);
+        if (p.x == median) {
+            sorted_by_x[ties_start + ties++] = p;
+        }
+        if (left) {
+            scratch[left_i++] = p;
+        } else {
+            scratch[right_i++] = p;
+        }
+    }
+
+    /* Recursively compute the closest pairs in each half, with `sorted_by_y` as their scratch
+     * space. The left half runs on a new thread if the problem is still big enough.
+     */
+    ClosestPairTask left = {
+        sorted_by_x, scratch, sorted_by_y, left_n, num_threads / 2, INFINITY
+    };
+    pthread_t thread;
+    bool forked = num_threads > 1 && n >= CLOSEST_PAIR_GRAIN
+                  && pthread_create(&thread, NULL, closest_pair_task, &left) == 0;
+    if (!forked) {
+        left.num_threads = num_threads;
+        closest_pair_task(&left);
+    }
+    double right_sq = closest_pair_helper(sorted_by_x + left_n, scratch + left_n,
+                                          sorted_by_y + left_n, n - left_n,
+                                          forked ? num_threads - num_threads / 2 : num_threads);
+    if (forked) {
+        pthread_join(thread, NULL);
+    }
+    double best_sq = fmin(left.best_sq, right_sq);
+
+    /* The halves are each still sorted by y in `scratch`, so merge them back into `sorted_by_y`. */
+    point_y_merge(scratch, left_n, scratch + left_n, n - left_n, sorted_by_y);
+    /* Find any pairs of points between the two halves that are closer than the closest pairs in
+     * either half alone.
+     */
+    return closest_in_strip(sorted_by_y, n, median, best_sq, scratch, num_threads);
+}
+
+static void* closest_pair_task(void* arg) {
+    ClosestPairTask* t = arg;
+    t->best_sq = closest_pair_helper(t->sorted_by_x, t->sorted_by_y, t->scratch, t->n,
+                                     t->num_threads);
+    return NULL;
+}
+
+
+/* Given the two lists of the same set of points, one in ascending order of the x-coordinate and
+ * the other in ascending order of the y-coordinate, return the distance between the two closest
  * points.
  *
  *   Idea: Draw a vertical line through the median of the x-coordinates of the point, so that
@@ -117,64 +1288,175 @@ size_t partition(int array[], size_t start, size_t end) {
  *
  *   Time analysis: The recurrence relation is clearly T(n) = 2T(n/2) + f(n), since the algorithm
  *   divides the problem in half and recurses on each half. The question then becomes, what is
- *   the complexity of the dividing and combining steps? Dividing is clearly linear since the entire
- *   array needs to be copied into two halves. Combining looks like it's quadratic, because it has
- *   a nested loop. However, the geometry of the problem guarantees that the inner loop body will
- *   run no more than 5 times, so combining is also linear. Thus, by the master method the overall
- *   complexity is O(n log n), which is a significant improvement over the brute force method.
+ *   the complexity of the dividing and combining steps? Dividing is clearly linear since each
+ *   list only needs to be split into two halves. Combining looks like it's quadratic, because it
+ *   has a nested loop. However, the geometry of the problem guarantees that the inner loop body
+ *   will run no more than 5 times, so combining is also linear. Thus, by the master method the
+ *   overall complexity is O(n log n), which is a significant improvement over the brute force
+ *   method.
  *
- *   Space analysis: O(n), to make the copies of the arrays needed for the recursive calls.
+ *   Space analysis: O(n), for copies of the two lists and a scratch buffer that every level of the
+ *   recursion shares: each level splits its list sorted by y into the scratch buffer, passes its
+ *   own list down as the scratch buffer of its halves, and merges the halves back afterwards.
  */
 double closest_pair(Point sorted_by_x[], Point sorted_by_y[], size_t n) {
-    if (n > 3) {
-        size_t right_n = n / 2;
-        size_t left_n = n - right_n;
-        Point* right_sorted_x = safe_malloc(right_n * sizeof *right_sorted_x);
-        Point* right_sorted_y = safe_malloc(right_n * sizeof *right_sorted_y);
-        for (size_t i = 0; i < right_n; i++) {
-            right_sorted_x[i] = sorted_by_x[left_n + i];
-            right_sorted_y[i] = sorted_by_y[left_n + i];
-        }
-        Point* left_sorted_x = safe_malloc(left_n * sizeof *left_sorted_x);
-        Point* left_sorted_y = safe_malloc(left_n * sizeof *left_sorted_y);
-        for (size_t i = 0; i < left_n; i++) {
-            left_sorted_x[i] = sorted_by_x[i];
-            left_sorted_y[i] = sorted_by_y[i];
-        }
-        /* Recursively compute the closest pairs from the left and the right points. */
-        double d_left = closest_pair(left_sorted_x, left_sorted_y, left_n);
-        double d_right = closest_pair(right_sorted_x, right_sorted_y, right_n);
-        double d = fmin(d_left, d_right);
-        double m = sorted_by_x[left_n - 1].x;
-        Point* points_near_median = safe_malloc(n * sizeof *points_near_median);
-        size_t num_near_median = 0;
-        for (size_t i = 0; i < n; i++) {
-            Point p = sorted_by_y[i];
-            if (abs(p.x - m) < d) {
-                points_near_median[num_near_median++] = p;
-            }
+    Point* x = safe_malloc((n + 1) * sizeof *x);
+    Point* y = safe_malloc((n + 1) * sizeof *y);
+    Point* scratch = safe_malloc((n + 1) * sizeof *scratch);
+    memcpy(x, sorted_by_x, n * sizeof *x);
+    memcpy(y, sorted_by_y, n * sizeof *y);
+    double best_sq = closest_pair_helper(x, y, scratch, n, 1);
+    free(x);
+    free(y);
+    free(scratch);
+    return n < 2 ? 0.0 : sqrt(best_sq);
+}
+
+
+/* Sort part of the presort of closest_pair_parallel: sort a chunk, or merge two sorted chunks. */
+typedef struct {
+    Point* array;
+    Point* scratch;
+    size_t start, mid, end;
+    bool by_x;
+} PresortTask;
+
+static void* presort_chunk(void* arg) {
+    PresortTask* t = arg;
+    if (t->by_x) {
+        point_x_quicksort(t->array + t->start, t->end - t->start);
+    } else {
+        point_y_quicksort(t->array + t->start, t->end - t->start);
+    }
+    return NULL;
+}
+
+static void* presort_merge(void* arg) {
+    PresortTask* t = arg;
+    Point* a = t->array;
+    if (t->by_x) {
+        point_x_merge(a + t->start, t->mid - t->start, a + t->mid, t->end - t->mid,
+                      t->scratch + t->start);
+    } else {
+        point_y_merge(a + t->start, t->mid - t->start, a + t->mid, t->end - t->mid,
+                      t->scratch + t->start);
+    }
+    memcpy(a + t->start, t->scratch + t->start, (t->end - t->start) * sizeof *a);
+    return NULL;
+}
+
+
+/* Sort `array` by x (or y) with `num_threads` threads: quicksort a chunk per thread, then merge
+ * pairs of chunks in parallel until one is left.
+ */
+static void presort(Point array[], Point scratch[], size_t n, bool by_x, int num_threads) {
+    PresortTask* tasks = safe_malloc(num_threads * sizeof *tasks);
+    for (int i = 0; i < num_threads; i++) {
+        tasks[i].array = array;
+        tasks[i].scratch = scratch;
+        tasks[i].start = n * i / num_threads;
+        tasks[i].end = n * (i + 1) / num_threads;
+        tasks[i].by_x = by_x;
+    }
+    run_in_parallel(presort_chunk, tasks, sizeof *tasks, num_threads);
+    for (int chunks = num_threads; chunks > 1; chunks = (chunks + 1) / 2) {
+        int merges = 0;
+        for (int i = 0; i + 1 < chunks; i += 2) {
+            tasks[merges] = tasks[i];
+            tasks[merges].mid = tasks[i].end;
+            tasks[merges].end = tasks[i+1].end;
+            merges++;
         }
-        double d_sq = d*d;
-        /* Find any pairs of points between the two halves that are closer than the closest pairs
-         * in either half alone. This looks like a quadratic loop, but it's really not! It can be
-         * shown using the pigeonhole principle that the inner loop is bounded by a constant.
-         */
-        for (size_t i = 0; i < num_near_median - 2; i++) {
-            size_t k = i + 1;
-            double tmp = pow(points_near_median[k].y - points_near_median[i].y, 2);
-            while (k <= num_near_median - 1 && tmp < d_sq) {
-                d_sq = fmin(tmp + pow(points_near_median[k].x - points_near_median[i].x, 2), d_sq);
-                k++;
-            }
+        run_in_parallel(presort_merge, tasks, sizeof *tasks, merges);
+        if (chunks % 2 == 1) {
+            /* The last chunk has no partner this round. */
+            tasks[merges] = tasks[chunks - 1];
         }
-        free(right_sorted_x);
-        free(right_sorted_y);
-        free(left_sorted_x);
-        free(left_sorted_y);
-        free(points_near_median);
-        return sqrt(d_sq);
+    }
+    free(tasks);
+}
+
+
+typedef struct {
+    Point* array;
+    Point* scratch;
+    size_t n;
+    bool by_x;
+    int num_threads;
+} PresortArgs;
+
+static void* presort_task(void* arg) {
+    PresortArgs* a = arg;
+    presort(a->array, a->scratch, a->n, a->by_x, a->num_threads);
+    return NULL;
+}
+
+
+/* Return the distance between the two closest of the `n` points (in any order), using up to
+ * `num_threads` threads.
+ *
+ *   Idea: The same algorithm as closest_pair, with the work split across threads at three places.
+ *   The lists sorted by x and by y are sorted at the same time, each by half the threads. The
+ *   recursion forks a thread for the left half and gives each half half of its threads, down to
+ *   halves of CLOSEST_PAIR_GRAIN points. And the strip at each of the top levels, which is a linear
+ *   pass over all of a level's points that would otherwise run on a single thread, is split into
+ *   a range per thread: each thread counts its points in the strip, then copies them into place,
+ *   then compares them to the points above them. The answer is the same as closest_pair's, since
+ *   it is the minimum of the same squared distances.
+ *
+ *   Time analysis: O(n log n) work, as for closest_pair, in O(n log n / p + n) time on p threads;
+ *   the remaining linear term is the splitting and merging of the lists at the top levels.
+ *
+ *   Space analysis: O(n), as for closest_pair.
+ */
+double closest_pair_parallel(const Point points[], size_t n, int num_threads) {
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+    Point* x = safe_malloc((n + 1) * sizeof *x);
+    Point* y = safe_malloc((n + 1) * sizeof *y);
+    Point* scratch = safe_malloc((2*n + 1) * sizeof *scratch);
+    memcpy(x, points, n * sizeof *x);
+    memcpy(y, points, n * sizeof *y);
+    PresortArgs by_x = { x, scratch, n, true, num_threads - num_threads / 2 };
+    PresortArgs by_y = { y, scratch + n, n, false, num_threads / 2 > 0 ? num_threads / 2 : 1 };
+    pthread_t thread;
+    bool forked = num_threads > 1 && pthread_create(&thread, NULL, presort_task, &by_y) == 0;
+    presort_task(&by_x);
+    if (forked) {
+        pthread_join(thread, NULL);
     } else {
-        return closest_pair_brute_force(sorted_by_x, n);
+        presort_task(&by_y);
+    }
+    double best_sq = closest_pair_helper(x, y, scratch, n, num_threads);
+    free(x);
+    free(y);
+    free(scratch);
+    return n < 2 ? 0.0 : sqrt(best_sq);
+}
+
+
+/* An adapter between arrays and the stream interface of kway_merge_stream, for testing. */
+typedef struct {
+    int* data;
+    size_t len, pos;
+} ArrayStream;
+
+
+static size_t array_stream_read(void* context, int buffer[], size_t capacity) {
+    ArrayStream* stream = context;
+    size_t n = 0;
+    while (n < capacity && stream->pos < stream->len) {
+        buffer[n++] = stream->data[stream->pos++];
+    }
+    return n;
+}
+
+
+static void array_stream_write(void* context, const int block[], size_t len) {
+    ArrayStream* stream = context;
+    for (size_t i = 0; i < len; i++) {
+        stream->data[stream->len++] = block[i];
     }
 }
 
@@ -187,6 +1469,94 @@ int ch05_tests() {
     puts("Testing merge sort");
     ASSERT(test_sorting_f(merge_sort) == 0);
 
+    /* TIMSORT */
+    puts("Testing timsort");
+    ASSERT(test_sorting_f(timsort) == 0);
+    /* Inputs with long runs and many duplicates exercise the merges and galloping. */
+    int timsort_data[3000], timsort_expected[3000];
+    int timsort_ok = 1;
+    for (int pattern = 0; pattern < 5; pattern++) {
+        for (int i = 0; i < 3000; i++) {
+            switch (pattern) {
+                case 0: timsort_data[i] = i; break;
+                case 1: timsort_data[i] = 3000 - i; break;
+                case 2: timsort_data[i] = (i * 7919) % 3001; break;
+                case 3: timsort_data[i] = i % 250 < 200 ? i % 250 : -(i % 7); break;
+                default: timsort_data[i] = i < 2000 ? i : (i * 31) % 2000; break;
+            }
+            timsort_expected[i] = timsort_data[i];
+        }
+        timsort(timsort_data, 3000);
+        i32_quicksort(timsort_expected, 3000);
+        for (int i = 0; i < 3000; i++) {
+            timsort_ok &= timsort_data[i] == timsort_expected[i];
+        }
+    }
+    ASSERT(timsort_ok);
+
+    /* IN-PLACE MERGE SORT */
+    puts("Testing in-place merge sort");
+    ASSERT(test_sorting_f(merge_sort_in_place) == 0);
+    int in_place_ok = 1;
+    int in_place_buffer[8];
+    for (int pattern = 2; pattern < 5; pattern++) {
+        for (size_t buffer_len = 0; buffer_len <= 8; buffer_len += 8) {
+            for (int i = 0; i < 3000; i++) {
+                timsort_data[i] = pattern == 2 ? (i * 7919) % 3001
+                                : pattern == 3 ? (i * 31) % 17 : 3000 - i;
+                timsort_expected[i] = timsort_data[i];
+            }
+            /* A buffer of 0 or 8 elements forces nearly every merge through the rotations. */
+            merge_sort_in_place_buffer(timsort_data, 3000, in_place_buffer, buffer_len);
+            i32_quicksort(timsort_expected, 3000);
+            for (int i = 0; i < 3000; i++) {
+                in_place_ok &= timsort_data[i] == timsort_expected[i];
+            }
+        }
+    }
+    ASSERT(in_place_ok);
+    /* Long enough that the blocks of the block merges are longer than the stack buffer. */
+    size_t long_n = 200000;
+    int* long_data = safe_malloc(long_n * sizeof *long_data);
+    int* long_expected = safe_malloc(long_n * sizeof *long_expected);
+    unsigned int long_state = 5;
+    for (int pattern = 0; pattern < 2; pattern++) {
+        for (size_t i = 0; i < long_n; i++) {
+            long_state = long_state * 1103515245 + 12345;
+            long_data[i] = pattern == 0 ? (int)(long_state >> 8) : (int)((long_state >> 8) % 7);
+            long_expected[i] = long_data[i];
+        }
+        merge_sort_in_place(long_data, long_n);
+        i32_quicksort(long_expected, long_n);
+        ASSERT(memcmp(long_data, long_expected, long_n * sizeof *long_data) == 0);
+    }
+    free(long_data);
+    free(long_expected);
+
+    /* K-WAY MERGE */
+    puts("Testing k-way merge");
+    int run0[] = {1, 4, 9};
+    int run1[] = {2, 3, 10, 11};
+    int run2[] = {0};
+    int run3[] = {4, 5};
+    int* runs[] = {run0, run1, NULL, run2, run3};
+    size_t lens[] = {3, 4, 0, 1, 2};
+    int kway_target[10];
+    kway_merge(runs, lens, 5, kway_target);
+    ASSERT(array_eq(10, kway_target, 0, 1, 2, 3, 4, 4, 5, 9, 10, 11));
+    kway_merge(runs, lens, 1, kway_target);
+    ASSERT(array_eq(3, kway_target, 1, 4, 9));
+
+    /* STREAMING K-WAY MERGE */
+    puts("Testing streaming k-way merge");
+    ArrayStream streams[] = { {run0, 3, 0}, {run1, 4, 0}, {run2, 1, 0}, {run3, 2, 0} };
+    void* sources[] = {&streams[0], &streams[1], &streams[2], &streams[3]};
+    ArrayStream sink = {kway_target, 0, 0};
+    /* A block length of 2 forces every buffer to be refilled at least once. */
+    kway_merge_stream(array_stream_read, sources, 4, array_stream_write, &sink, 2);
+    ASSERT(sink.len == 10);
+    ASSERT(array_eq(10, kway_target, 0, 1, 2, 3, 4, 4, 5, 9, 10, 11));
+
     /* QUICKSORT */
     puts("Testing quicksort");
     ASSERT(test_sorting_f(quicksort) == 0);
@@ -196,6 +1566,41 @@ int ch05_tests() {
     Point points_by_x[] = { {2, 3}, {3, 1}, {7, 3}, {7, 1} };
     Point points_by_y[] = { {3, 1}, {7, 1}, {2, 3}, {7, 3} };
     ASSERT(closest_pair(points_by_x, points_by_y, 4) == 2);
+    /* Small integer coordinates, so that many points share an x-coordinate and some coincide. */
+    Point* random_points = safe_malloc(2000 * sizeof *random_points);
+    Point* random_by_x = safe_malloc(2000 * sizeof *random_by_x);
+    Point* random_by_y = safe_malloc(2000 * sizeof *random_by_y);
+    int closest_pair_ok = 1;
+    for (int range = 40; range <= 4000; range *= 10) {
+        for (int i = 0; i < 2000; i++) {
+            random_points[i].x = (i * 7919) % range;
+            random_points[i].y = (i * 104729 + i / 3) % (range * 3);
+        }
+        memcpy(random_by_x, random_points, 2000 * sizeof *random_points);
+        memcpy(random_by_y, random_points, 2000 * sizeof *random_points);
+        point_x_insertion_sort(random_by_x, 2000);
+        point_y_insertion_sort(random_by_y, 2000);
+        double expected = closest_pair_brute_force(random_points, 2000);
+        closest_pair_ok &= closest_pair(random_by_x, random_by_y, 2000) == expected;
+        closest_pair_ok &= closest_pair_parallel(random_points, 2000, 1) == expected;
+        closest_pair_ok &= closest_pair_parallel(random_points, 2000, 3) == expected;
+    }
+    free(random_points);
+    free(random_by_x);
+    free(random_by_y);
+    ASSERT(closest_pair_ok);
+    /* Big enough that the recursion forks and the strip is split across threads. */
+    Point* many_points = safe_malloc(200000 * sizeof *many_points);
+    unsigned int state = 1;
+    for (int i = 0; i < 200000; i++) {
+        state = state * 1103515245 + 12345;
+        many_points[i].x = state % 1000003;
+        state = state * 1103515245 + 12345;
+        many_points[i].y = (double)(state % 1000003) / 7;
+    }
+    ASSERT(closest_pair_parallel(many_points, 200000, 4) ==
+           closest_pair_parallel(many_points, 200000, 1));
+    free(many_points);
 
     return tests_failed;
 }
@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include <stdbool.h>
 #include "algorithms.h"
 
@@ -88,6 +89,191 @@ void fix_heap(size_t index, int heap[], size_t n) {
 }
 
 
+SORTING_DEFINE_STATIC(ordered_vertex, OrderedVertex, LESS_THAN_KEY)
+SORTING_DEFINE_STATIC(position, size_t, LESS_THAN)
+
+
+static size_t out_degree(const Vertex* v) {
+    size_t degree = 0;
+    for (VertexList* p = v->neighbors; p != NULL; p = p->next) {
+        degree++;
+    }
+    return degree;
+}
+
+
+/* Fill `sorted` with the vertices of `g` sorted by their `degrees`, from the lowest to the highest
+ * or the reverse, with ties in order of index, using a counting sort.
+ */
+static void sort_by_degree(const Graph* g, const size_t degrees[], bool descending,
+                           size_t sorted[]) {
+    size_t max_degree = 0;
+    for (size_t v = 0; v < g->n; v++) {
+        if (degrees[v] > max_degree) max_degree = degrees[v];
+    }
+    size_t* starts = safe_calloc(max_degree + 2, sizeof *starts);
+    for (size_t v = 0; v < g->n; v++) {
+        starts[(descending ? max_degree - degrees[v] : degrees[v]) + 1]++;
+    }
+    for (size_t d = 1; d <= max_degree + 1; d++) {
+        starts[d] += starts[d-1];
+    }
+    for (size_t v = 0; v < g->n; v++) {
+        sorted[starts[descending ? max_degree - degrees[v] : degrees[v]]++] = v;
+    }
+    free(starts);
+}
+
+
+/* Return a malloc'd permutation `order` of the vertices of `g`, where order[i] is the index of the
+ * vertex to put at position i when relabeling the graph with graph_permute.
+ *
+ *   Idea: Give vertices that are visited together nearby labels, so that they share cache lines.
+ *   ORDER_BFS lists the vertices in the order that breadth-first search from each unvisited vertex
+ *   in turn reaches them. ORDER_DEGREE lists them from the highest out-degree to the lowest, so
+ *   that the hubs of a power-law graph, which most edges lead to, are packed together. ORDER_RCM
+ *   is the reverse Cuthill-McKee ordering: breadth-first search started at a vertex of the lowest
+ *   degree, which visits each vertex's neighbors from the lowest degree to the highest, reversed.
+ *   Labels along every edge then stay close together (a small bandwidth) on mesh-like graphs.
+ *   ORDER_BFS and ORDER_RCM follow edges in their direction, so they suit undirected graphs best.
+ *
+ *   Time analysis: O(|V| + |E|) for ORDER_BFS and ORDER_DEGREE, and O(|V| + |E| log d) for
+ *   ORDER_RCM, where d is the largest degree, for sorting each vertex's neighbors by degree.
+ *
+ *   Space analysis: O(|V|) besides the result, plus O(d) for ORDER_RCM.
+ */
+size_t* vertex_ordering(const Graph* g, enum VertexOrdering kind) {
+    size_t n = g->n;
+    size_t* order = safe_malloc((n > 0 ? n : 1) * sizeof *order);
+    size_t* degrees = safe_malloc((n > 0 ? n : 1) * sizeof *degrees);
+    for (size_t v = 0; v < n; v++) {
+        degrees[v] = out_degree(&g->vertices[v]);
+    }
+    if (kind == ORDER_DEGREE) {
+        sort_by_degree(g, degrees, true, order);
+        free(degrees);
+        return order;
+    }
+
+    /* Both of the others are breadth-first searches that use `order` itself as the queue, and
+     * mark each vertex when it is pushed.
+     */
+    size_t* starts = safe_malloc((n > 0 ? n : 1) * sizeof *starts);
+    if (kind == ORDER_RCM) {
+        sort_by_degree(g, degrees, false, starts);
+    } else {
+        for (size_t v = 0; v < n; v++) starts[v] = v;
+    }
+    bool* visited = safe_calloc(n > 0 ? n : 1, sizeof *visited);
+    OrderedVertex* pushed = NULL;
+    size_t pushed_capacity = 0;
+    size_t tail = 0;
+    for (size_t s = 0; s < n; s++) {
+        if (visited[starts[s]]) continue;
+        visited[starts[s]] = true;
+        order[tail++] = starts[s];
+        for (size_t head = tail - 1; head < tail; head++) {
+            const Vertex* v = &g->vertices[order[head]];
+            if (kind == ORDER_BFS) {
+                for (VertexList* p = v->neighbors; p != NULL; p = p->next) {
+                    size_t u = (size_t)(p->v - g->vertices);
+                    if (!visited[u]) {
+                        visited[u] = true;
+                        order[tail++] = u;
+                    }
+                }
+                continue;
+            }
+            if (degrees[order[head]] > pushed_capacity) {
+                pushed_capacity = degrees[order[head]];
+                pushed = safe_realloc(pushed, pushed_capacity * sizeof *pushed);
+            }
+            size_t num_pushed = 0;
+            for (VertexList* p = v->neighbors; p != NULL; p = p->next) {
+                size_t u = (size_t)(p->v - g->vertices);
+                if (!visited[u]) {
+                    visited[u] = true;
+                    pushed[num_pushed].key = degrees[u];
+                    pushed[num_pushed++].vertex = u;
+                }
+            }
+            ordered_vertex_quicksort(pushed, num_pushed);
+            for (size_t i = 0; i < num_pushed; i++) {
+                order[tail++] = pushed[i].vertex;
+            }
+        }
+    }
+    if (kind == ORDER_RCM) {
+        for (size_t i = 0; i < n / 2; i++) {
+            size_t t = order[i];
+            order[i] = order[n-1-i];
+            order[n-1-i] = t;
+        }
+    }
+    free(pushed);
+    free(visited);
+    free(starts);
+    free(degrees);
+    return order;
+}
+
+
+/* Return a new graph with the vertices of `g` relabeled so that vertex order[i] of `g` is vertex i
+ * of the new graph, for a permutation `order` such as vertex_ordering returns.
+ *
+ *   Idea: Besides the vertices, the adjacency lists are laid out in the new order: the list nodes
+ *   are allocated one after another, vertex by vertex and each vertex's sorted by their new index.
+ *   The allocator then mostly hands them out next to each other, so traversing the new graph reads
+ *   memory mostly sequentially instead of chasing nodes all over the heap. Each node is still its
+ *   own allocation, so the new graph's lists can be changed and freed like any other graph's.
+ *
+ *   Time analysis: O(|V| + |E| log d), where d is the largest degree, for sorting the neighbors.
+ *
+ *   Space analysis: O(|V| + |E|) for the new graph.
+ */
+Graph* graph_permute(const Graph* g, const size_t order[]) {
+    size_t n = g->n;
+    size_t* positions = safe_malloc((n > 0 ? n : 1) * sizeof *positions);
+    for (size_t i = 0; i < n; i++) {
+        positions[order[i]] = i;
+    }
+    /* Collect the new neighbors of every vertex in a single pass over the old lists, since on a
+     * large graph whose nodes are scattered over the heap, that pass is most of the work.
+     */
+    size_t* ends = safe_malloc((n > 0 ? n : 1) * sizeof *ends);
+    size_t capacity = 2 * n + 8, num_edges = 0;
+    size_t* targets = safe_malloc(capacity * sizeof *targets);
+    for (size_t i = 0; i < n; i++) {
+        size_t start = num_edges;
+        for (VertexList* p = g->vertices[order[i]].neighbors; p != NULL; p = p->next) {
+            if (num_edges == capacity) {
+                capacity *= 2;
+                targets = safe_realloc(targets, capacity * sizeof *targets);
+            }
+            targets[num_edges++] = positions[p->v - g->vertices];
+        }
+        position_quicksort(targets + start, num_edges - start);
+        ends[i] = num_edges;
+    }
+    Graph* ret = graph_new(n);
+    for (size_t i = 0, start = 0; i < n; start = ends[i++]) {
+        ret->vertices[i].val = g->vertices[order[i]].val;
+        VertexList** link = &ret->vertices[i].neighbors;
+        for (size_t e = start; e < ends[i]; e++) {
+            VertexList* node = safe_malloc(sizeof *node);
+            node->v = &ret->vertices[targets[e]];
+            *link = node;
+            link = &node->next;
+        }
+        *link = NULL;
+    }
+    free(targets);
+    free(ends);
+    free(positions);
+    return ret;
+}
+
+
 int ch06_tests() {
     puts("\n=== CHAPTER 6 TESTS ===");
     int tests_failed = 0;
@@ -96,5 +282,87 @@ int ch06_tests() {
     puts("Testing heapsort");
     ASSERT(test_sorting_f(heapsort) == 0);
 
+    /* VERTEX ORDERING */
+    puts("Testing vertex_ordering and graph_permute");
+    /* A path whose labels are scrambled, so its bandwidth is large until RCM relabels it. */
+    size_t n = 1000;
+    Graph* g = graph_new(n);
+    size_t* labels = safe_malloc(n * sizeof *labels);
+    for (size_t i = 0; i < n; i++) {
+        labels[i] = i * 7919 % n;
+        g->vertices[i].val = (char)('a' + i % 26);
+    }
+    for (size_t i = 0; i + 1 < n; i++) {
+        graph_add_edge_index(g, labels[i], labels[i+1]);
+        graph_add_edge_index(g, labels[i+1], labels[i]);
+    }
+    /* A hub, so the degrees are not all the same. */
+    for (size_t i = 0; i < n; i += 3) {
+        graph_add_edge_index(g, labels[500], i);
+    }
+    enum VertexOrdering kinds[] = { ORDER_BFS, ORDER_DEGREE, ORDER_RCM };
+    int permutation_ok = 1, edges_ok = 1, sorted_ok = 1;
+    for (size_t k = 0; k < sizeof kinds / sizeof kinds[0]; k++) {
+        size_t* order = vertex_ordering(g, kinds[k]);
+        bool* seen = safe_calloc(n, sizeof *seen);
+        for (size_t i = 0; i < n; i++) {
+            permutation_ok &= order[i] < n && !seen[order[i]];
+            if (order[i] < n) seen[order[i]] = true;
+        }
+        free(seen);
+        Graph* permuted = graph_permute(g, order);
+        GraphMatrix* before = graph_matrix_from_graph(g);
+        GraphMatrix* after = graph_matrix_from_graph(permuted);
+        for (size_t i = 0; i < n; i++) {
+            edges_ok &= permuted->vertices[i].val == g->vertices[order[i]].val;
+            for (size_t j = 0; j < n; j++) {
+                edges_ok &= !MATRIX_HAS_EDGE(after, i, j)
+                         == !MATRIX_HAS_EDGE(before, order[i], order[j]);
+            }
+            for (VertexList* p = permuted->vertices[i].neighbors; p && p->next; p = p->next) {
+                sorted_ok &= p->v < p->next->v;
+            }
+        }
+        if (kinds[k] == ORDER_DEGREE) {
+            ASSERT(order[0] == labels[500]);
+        }
+        graph_matrix_free(before);
+        graph_matrix_free(after);
+        /* The new graph's lists can be changed like any other graph's. */
+        graph_add_edge_index(permuted, 0, n - 1);
+        VertexList* first = permuted->vertices[0].neighbors;
+        permuted->vertices[0].neighbors = first->next;
+        free(first);
+        vertex_list_free(permuted->vertices[1].neighbors);
+        permuted->vertices[1].neighbors = NULL;
+        graph_free(permuted);
+        free(order);
+    }
+    ASSERT(permutation_ok);
+    ASSERT(edges_ok);
+    ASSERT(sorted_ok);
+    graph_free(g);
+
+    /* Without the hub, RCM turns the path back into a path of consecutive labels. */
+    g = graph_new(n);
+    for (size_t i = 0; i + 1 < n; i++) {
+        graph_add_edge_index(g, labels[i], labels[i+1]);
+        graph_add_edge_index(g, labels[i+1], labels[i]);
+    }
+    size_t* order = vertex_ordering(g, ORDER_RCM);
+    Graph* permuted = graph_permute(g, order);
+    int bandwidth_ok = 1;
+    for (size_t i = 0; i < n; i++) {
+        for (VertexList* p = permuted->vertices[i].neighbors; p != NULL; p = p->next) {
+            size_t j = (size_t)(p->v - permuted->vertices);
+            bandwidth_ok &= j + 1 == i || i + 1 == j;
+        }
+    }
+    ASSERT(bandwidth_ok);
+    graph_free(permuted);
+    free(order);
+    graph_free(g);
+    free(labels);
+
     return tests_failed;
 }
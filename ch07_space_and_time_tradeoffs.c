@@ -0,0 +1,1110 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "algorithms.h"
+
+
+/* Sort the elements of `array` in ascending order.
+ *
+ *   Idea: Distribution counting, one byte at a time starting from the least significant (LSD
+ *   radix sort). For each byte, count how many elements have each of the 256 possible values,
+ *   which tells you where each group of elements starts in the output, and then copy each element
+ *   to the next free spot in its group. Distribution counting is stable, so after sorting by the
+ *   i'th byte, elements with the same i'th byte are still in order of their lower bytes.
+ *
+ *   Time analysis: Each of the 8 passes is O(n + 256), so O(n) overall. Passes where every element
+ *   has the same byte (e.g., the high bytes of small numbers) are skipped.
+ *
+ *   Space analysis: O(n) for the scratch buffer that each pass copies into.
+ */
+void radix_sort_u64(uint64_t array[], size_t n) {
+    radix_sort_u64_bytes(array, n, 0, 8);
+}
+
+
+/* Radix sort `array` on bytes [first_byte, last_byte) of its elements only. Since the sort is
+ * stable, elements that are equal in those bytes keep their relative order.
+ */
+void radix_sort_u64_bytes(uint64_t array[], size_t n, int first_byte, int last_byte) {
+    if (n < 2) return;
+    /* Counting every byte in a single pass over the array saves reading it once per byte. */
+    size_t (*counts)[256] = safe_calloc(8, sizeof *counts);
+    for (size_t i = 0; i < n; i++) {
+        for (int b = first_byte; b < last_byte; b++) {
+            counts[b][(array[i] >> (8*b)) & 0xff]++;
+        }
+    }
+    uint64_t* scratch = safe_malloc(n * sizeof *scratch);
+    uint64_t* from = array;
+    uint64_t* to = scratch;
+    for (int b = first_byte; b < last_byte; b++) {
+        if (counts[b][(array[0] >> (8*b)) & 0xff] == n) {
+            /* Every element has the same value for this byte. */
+            continue;
+        }
+        /* Turn the counts into the starting position of each group. */
+        size_t total = 0;
+        for (int v = 0; v < 256; v++) {
+            size_t c = counts[b][v];
+            counts[b][v] = total;
+            total += c;
+        }
+        for (size_t i = 0; i < n; i++) {
+            to[counts[b][(from[i] >> (8*b)) & 0xff]++] = from[i];
+        }
+        uint64_t* tmp = from;
+        from = to;
+        to = tmp;
+    }
+    if (from != array) {
+        memcpy(array, from, n * sizeof *array);
+    }
+    free(scratch);
+    free(counts);
+}
+
+
+/* A key and its position in the array of keys, for argsort. */
+typedef struct {
+    int key;
+    uint32_t index;
+} KeyIndex;
+
+SORTING_DEFINE_STATIC(key_index, KeyIndex, LESS_THAN_KEY)
+
+
+/* Set perm[i] to the index of the i'th smallest element of `keys`, so that keys[perm[0]],
+ * keys[perm[1]], ... is in ascending order. Elements with equal keys may appear in any order.
+ * `n` must be less than 2^32.
+ *
+ *   Idea: Sort (key, index) pairs by key with the type-generic quicksort.
+ *
+ *   Time analysis: O(n log n).
+ *
+ *   Space analysis: O(n) for the pairs.
+ */
+void argsort(const int* keys, size_t n, uint32_t* perm) {
+    KeyIndex* pairs = safe_malloc(n * sizeof *pairs);
+    for (size_t i = 0; i < n; i++) {
+        pairs[i].key = keys[i];
+        pairs[i].index = (uint32_t)i;
+    }
+    key_index_quicksort(pairs, n);
+    for (size_t i = 0; i < n; i++) {
+        perm[i] = pairs[i].index;
+    }
+    free(pairs);
+}
+
+
+/* The same as argsort, except that elements with equal keys appear in order of their index.
+ *
+ *   Idea: Sort (key, index) pairs with the type-generic merge sort, which is stable.
+ *
+ *   Time analysis: O(n log n).
+ *
+ *   Space analysis: O(n) for the pairs and the merge buffer.
+ */
+void argsort_stable(const int* keys, size_t n, uint32_t* perm) {
+    KeyValue* pairs = safe_malloc(n * sizeof *pairs);
+    for (size_t i = 0; i < n; i++) {
+        pairs[i].key = keys[i];
+        pairs[i].payload = (int64_t)i;
+    }
+    kv_merge_sort(pairs, n);
+    for (size_t i = 0; i < n; i++) {
+        perm[i] = (uint32_t)pairs[i].payload;
+    }
+    free(pairs);
+}
+
+
+/* The same as argsort_stable, but usually several times faster.
+ *
+ *   Idea: Pack each key and its index into a single 64-bit integer with PACK_KEY_INDEX, with the
+ *   key in the high half (with its sign bit flipped, so that negative keys come first when the
+ *   packed values are compared as unsigned numbers) and the index in the low half. Comparing the
+ *   packed integers then compares by key and breaks ties by index, so they can be sorted as plain
+ *   integers, and since they are built in order of their index, only the four key bytes need to be
+ *   radix sorted.
+ *
+ *   Time analysis: O(n), for four passes of distribution counting.
+ *
+ *   Space analysis: O(n) for the packed integers and the radix sort's scratch buffer.
+ */
+void argsort_packed(const int* keys, size_t n, uint32_t* perm) {
+    uint64_t* packed = safe_malloc(n * sizeof *packed);
+    for (size_t i = 0; i < n; i++) {
+        packed[i] = PACK_KEY_INDEX(keys[i], i);
+    }
+    radix_sort_u64_bytes(packed, n, 4, 8);
+    for (size_t i = 0; i < n; i++) {
+        perm[i] = UNPACK_INDEX(packed[i]);
+    }
+    free(packed);
+}
+
+
+/* Set dst[i] = src[perm[i]] for each i, where `src` and `dst` are arrays of elements of
+ * `elem_size` bytes. This reorders a column of data by a permutation from argsort in one pass.
+ */
+void gather(const void* src, size_t elem_size, const uint32_t* perm, size_t n, void* dst) {
+    const char* s = src;
+    char* d = dst;
+    /* A memcpy with a constant size compiles to a single load and store, instead of a call per
+     * element (and unlike casting to an integer pointer, it is valid for any element type).
+     */
+    if (elem_size == 4) {
+        for (size_t i = 0; i < n; i++) {
+            memcpy(d + 4*i, s + 4*(size_t)perm[i], 4);
+        }
+    } else if (elem_size == 8) {
+        for (size_t i = 0; i < n; i++) {
+            memcpy(d + 8*i, s + 8*(size_t)perm[i], 8);
+        }
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            memcpy(d + i * elem_size, s + perm[i] * elem_size, elem_size);
+        }
+    }
+}
+
+
+/* The id of no point. */
+#define NO_POINT SIZE_MAX
+
+/* The most points a cell of a ClosestPairSet holds before it is split into four. */
+#define CELL_LIMIT 16
+
+/* The most points a split cell holds before it is merged back into one. Any ten points in a square
+ * include two closer than half its side, which is what keeps the closest pair findable.
+ */
+#define CELL_MERGE_LIMIT 9
+
+/* How many levels below the top cells a cell may be, so that cell coordinates fit in 64 bits. */
+#define MAX_CELL_DEPTH 60
+
+/* Create an empty set of points.
+ *
+ *   Idea: Keep the points in a quadtree of square cells with sides of length 2^level, stored in a
+ *   hash table keyed by level and coordinates. The four top cells meet at the origin and are wider
+ *   than four times any coordinate, a cell is split into its four quarters when it holds more than
+ *   CELL_LIMIT points, and a split cell is merged back into one when it holds no more than
+ *   CELL_MERGE_LIMIT. Call two points neighbors if they are closer than the sides of both their
+ *   cells. Each point keeps its closest neighbor as its `best`, and a min heap holds the pair of
+ *   each point and its best, so the closest pair is at the top if it is a pair of neighbors.
+ *
+ *   It always is: a cell below the top is a quarter of a split cell, whose more than
+ *   CELL_MERGE_LIMIT points include two closer than the side of the quarter, and the top cells are
+ *   wider than any distance. A new point finds its neighbors in the 3x3 blocks of cells around it
+ *   on its own level and on each finer level with cells nearby, and becomes the best of those it
+ *   is closer to. Removing a point makes the points whose best it was search again, which each
+ *   point keeps track of in a list. Splitting a cell only removes neighbors, so the bests stay
+ *   valid, and merging one makes its points search again. Crowding points into a small area and
+ *   then draining them again only splits and merges the cells there, and nothing is ever rebuilt
+ *   from scratch. Replaced and removed pairs are discarded when they reach the top of the heap, and
+ *   the heap is compacted once it is more than twice the number of points.
+ *
+ *   Time analysis: A search looks at O(1) cells of O(CELL_LIMIT) points on each level around the
+ *   point, down to the finest level with cells nearby, so it takes O(h) expected time, where h is
+ *   the depth of the quadtree: at most MAX_CELL_DEPTH, and about log(w/d) for points spread over a
+ *   width w with the closest pair d apart. An insertion walks down from the top in O(h) and does
+ *   one search. A removal does one search for each point whose best it was, which is O(1) points
+ *   in the plane. Splits and merges cost O(CELL_LIMIT) searches, and are amortized over the
+ *   CELL_LIMIT - CELL_MERGE_LIMIT updates it takes to undo them, and a compaction is amortized over
+ *   the n pairs pushed since the last one. So updates take O(h + log n) amortized expected time
+ *   whatever order they come in, and queries are O(1). Cells are not split below MAX_CELL_DEPTH or
+ *   when all their points are equal, so many copies of one point make updates near it slower.
+ *
+ *   Space analysis: O(n h) for the cells and O(n) for the heap.
+ */
+ClosestPairSet* closest_pair_set_new(void) {
+    ClosestPairSet* ret = safe_calloc(1, sizeof *ret);
+    ret->free_slot = NO_POINT;
+    return ret;
+}
+
+
+/* Free the entries of every cell, and empty the table. */
+static void cells_clear(ClosestPairSet* set) {
+    for (size_t i = 0; i < set->cells_capacity; i++) {
+        if (set->cells[i].used) {
+            free(set->cells[i].entries);
+            set->cells[i].used = false;
+        }
+    }
+    set->num_cells = 0;
+}
+
+
+void closest_pair_set_free(ClosestPairSet* set) {
+    cells_clear(set);
+    free(set->slots);
+    free(set->cells);
+    free(set->heap);
+    free(set);
+}
+
+
+static int64_t cell_coordinate(double v, int level) {
+    return (int64_t)floor(ldexp(v, -level));
+}
+
+
+/* Return the coordinate of the cell one level up that contains the cell at coordinate `c`. */
+static int64_t parent_coordinate(int64_t c) {
+    return c >= 0 ? c / 2 : -((1 - c) / 2);
+}
+
+
+/* Return the cell at (level, x, y). If it doesn't exist, create it if `create` is set, and
+ * otherwise return NULL. Cells with no points are left in the table, and are reused as empty
+ * unsplit cells when they are created again.
+ */
+static GridCell* cell_find(ClosestPairSet* set, int level, int64_t x, int64_t y, bool create) {
+    if (set->cells_capacity == 0) {
+        return NULL;
+    }
+    size_t mask = set->cells_capacity - 1;
+    uint64_t h = (uint64_t)x * 0x9e3779b97f4a7c15ULL ^ (uint64_t)y * 0xc2b2ae3d27d4eb4fULL
+                 ^ (uint64_t)level * 0x165667b19e3779f9ULL;
+    for (size_t i = (size_t)(h ^ (h >> 32)) & mask; ; i = (i + 1) & mask) {
+        GridCell* c = &set->cells[i];
+        if (!c->used) {
+            if (!create) {
+                return NULL;
+            }
+            *c = (GridCell){ .x = x, .y = y, .level = level, .used = true };
+            set->num_cells++;
+            return c;
+        }
+        if (c->x == x && c->y == y && c->level == level) {
+            if (create && c->count == 0) {
+                c->split = false;
+            }
+            return c;
+        }
+    }
+}
+
+
+/* Return the cell at (level, x, y), creating it if it doesn't exist. This may move the other
+ * cells, so pointers to them are not valid afterwards.
+ */
+static GridCell* cell_get(ClosestPairSet* set, int level, int64_t x, int64_t y) {
+    if (2 * (set->num_cells + 1) > set->cells_capacity) {
+        /* Move the cells with points into a new table, leaving the empty ones behind. */
+        GridCell* old = set->cells;
+        size_t old_capacity = set->cells_capacity;
+        size_t live = 0;
+        for (size_t i = 0; i < old_capacity; i++) {
+            live += old[i].used && old[i].count > 0;
+        }
+        size_t capacity = 16;
+        while (capacity < 4 * (live + 1)) {
+            capacity *= 2;
+        }
+        set->cells = safe_calloc(capacity, sizeof *set->cells);
+        set->cells_capacity = capacity;
+        set->num_cells = 0;
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old[i].used && old[i].count > 0) {
+                *cell_find(set, old[i].level, old[i].x, old[i].y, true) = old[i];
+            } else if (old[i].used) {
+                free(old[i].entries);
+            }
+        }
+        free(old);
+    }
+    return cell_find(set, level, x, y, true);
+}
+
+
+/* Return the cell of the point `id`. */
+static GridCell* cell_of(ClosestPairSet* set, size_t id) {
+    Point p = set->slots[id].point;
+    int level = set->slots[id].level;
+    return cell_find(set, level, cell_coordinate(p.x, level), cell_coordinate(p.y, level), false);
+}
+
+
+/* Add the point `id` to the entries of the unsplit cell `c`. */
+static void cell_append(ClosestPairSet* set, GridCell* c, size_t id) {
+    if (c->count == c->entries_capacity) {
+        c->entries_capacity = c->entries_capacity > 0 ? 2 * c->entries_capacity : 4;
+        c->entries = safe_realloc(c->entries, c->entries_capacity * sizeof *c->entries);
+    }
+    PointSlot* slot = &set->slots[id];
+    slot->level = c->level;
+    slot->index = c->count;
+    c->entries[c->count++] = (CellEntry){ slot->point, slot->best_dist_sq, id };
+}
+
+
+/* A pair is live if neither point has been removed since it was found, and it is still the pair of
+ * its first point with its `best`.
+ */
+static bool pair_is_live(const ClosestPairSet* set, PointPair pair) {
+    return set->slots[pair.a].generation == pair.generation_a
+        && set->slots[pair.b].generation == pair.generation_b
+        && set->slots[pair.a].best == pair.b;
+}
+
+
+static void pair_sift_down(PointPair heap[], size_t index, size_t n) {
+    PointPair v = heap[index];
+    while (2*index + 1 < n) {
+        size_t j = 2*index + 1;
+        if (j + 1 < n && heap[j+1].dist_sq < heap[j].dist_sq) {
+            j++;
+        }
+        if (v.dist_sq <= heap[j].dist_sq) {
+            break;
+        }
+        heap[index] = heap[j];
+        index = j;
+    }
+    heap[index] = v;
+}
+
+
+static void pair_push(ClosestPairSet* set, PointPair pair) {
+    if (set->heap_len == set->heap_capacity) {
+        set->heap_capacity = set->heap_capacity > 0 ? 2 * set->heap_capacity : 16;
+        set->heap = safe_realloc(set->heap, set->heap_capacity * sizeof *set->heap);
+    }
+    size_t i = set->heap_len++;
+    while (i > 0 && pair.dist_sq < set->heap[(i-1) / 2].dist_sq) {
+        set->heap[i] = set->heap[(i-1) / 2];
+        i = (i-1) / 2;
+    }
+    set->heap[i] = pair;
+}
+
+
+static int pair_compare(const void* p1, const void* p2) {
+    size_t a = ((const PointPair*)p1)->a;
+    size_t b = ((const PointPair*)p2)->a;
+    return (a > b) - (a < b);
+}
+
+
+/* Discard dead pairs from the top of the heap, and compact it once it is mostly dead pairs. */
+static void pair_heap_settle(ClosestPairSet* set) {
+    if (set->heap_len > 2 * set->n + 64) {
+        /* A pair can be replaced and then found again, so keep one live pair per point. */
+        size_t len = 0;
+        for (size_t i = 0; i < set->heap_len; i++) {
+            if (pair_is_live(set, set->heap[i])) {
+                set->heap[len++] = set->heap[i];
+            }
+        }
+        qsort(set->heap, len, sizeof *set->heap, pair_compare);
+        size_t unique = 0;
+        for (size_t i = 0; i < len; i++) {
+            if (unique == 0 || set->heap[unique-1].a != set->heap[i].a) {
+                set->heap[unique++] = set->heap[i];
+            }
+        }
+        set->heap_len = unique;
+        for (size_t i = unique / 2; i-- > 0; ) {
+            pair_sift_down(set->heap, i, unique);
+        }
+        set->compactions++;
+    }
+    while (set->heap_len > 0 && !pair_is_live(set, set->heap[0])) {
+        set->heap[0] = set->heap[--set->heap_len];
+        pair_sift_down(set->heap, 0, set->heap_len);
+    }
+}
+
+
+/* Make `q` the best of the point `p`, at squared distance `dist_sq`, or clear it if `q` is
+ * NO_POINT.
+ */
+static void pair_set_best(ClosestPairSet* set, size_t p, size_t q, double dist_sq) {
+    PointSlot* slots = set->slots;
+    if (slots[p].best != NO_POINT) {
+        size_t next = slots[p].watch_next, prev = slots[p].watch_prev;
+        if (prev != NO_POINT) {
+            slots[prev].watch_next = next;
+        } else {
+            slots[slots[p].best].watchers = next;
+        }
+        if (next != NO_POINT) {
+            slots[next].watch_prev = prev;
+        }
+    }
+    slots[p].best = q;
+    slots[p].best_dist_sq = dist_sq;
+    cell_of(set, p)->entries[slots[p].index].best_dist_sq = dist_sq;
+    if (q != NO_POINT) {
+        slots[p].watch_prev = NO_POINT;
+        slots[p].watch_next = slots[q].watchers;
+        if (slots[q].watchers != NO_POINT) {
+            slots[slots[q].watchers].watch_prev = p;
+        }
+        slots[q].watchers = p;
+        PointPair pair = { dist_sq, p, q, slots[p].generation, slots[q].generation };
+        pair_push(set, pair);
+    }
+}
+
+
+/* Return the squared distance from `p` to the nearest point of the cell `c`. */
+static double cell_distance_squared(Point p, const GridCell* c) {
+    double side = ldexp(1, c->level);
+    double left = ldexp((double)c->x, c->level);
+    double bottom = ldexp((double)c->y, c->level);
+    double dx = fmax(0, fmax(left - p.x, p.x - (left + side)));
+    double dy = fmax(0, fmax(bottom - p.y, p.y - (bottom + side)));
+    return dx*dx + dy*dy;
+}
+
+
+/* Look through the points in the unsplit cell `c` that are closer to the point `id` than 2^level,
+ * keeping track of the closest in `closest`. If `update` is set, also make `id` the best of those
+ * it is closer to than their current best, and otherwise skip the cell if it is no closer than
+ * `closest`.
+ */
+static void pair_scan(ClosestPairSet* set, size_t id, const GridCell* c, int level, bool update,
+                      size_t* closest, double* closest_sq) {
+    Point p = set->slots[id].point;
+    double max_sq = ldexp(1, 2 * level);
+    double cell_sq = cell_distance_squared(p, c);
+    if (cell_sq >= max_sq || (!update && cell_sq >= *closest_sq)) {
+        return;
+    }
+    for (size_t i = 0; i < c->count; i++) {
+        CellEntry e = c->entries[i];
+        double dist_sq = distance_squared(p, e.point);
+        if (e.id == id || dist_sq >= max_sq) {
+            continue;
+        }
+        if (dist_sq < *closest_sq) {
+            *closest = e.id;
+            *closest_sq = dist_sq;
+        }
+        if (update && dist_sq < e.best_dist_sq) {
+            pair_set_best(set, e.id, id, dist_sq);
+        }
+    }
+}
+
+
+/* The 3x3 block of cells around a cell, starting with the cell itself. */
+static const int block_offsets[9][2] = {
+    { 0, 0 }, { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 }, { -1, -1 }, { -1, 1 }, { 1, -1 }, { 1, 1 }
+};
+
+
+/* Find the closest point q to the point `id` that is closer to it than the sides of both their
+ * cells, and make it the best of `id` if it is closer than the current one. If `update` is set,
+ * also make `id` the best of each such q that it is closer to than q's current best.
+ */
+static void pair_search(ClosestPairSet* set, size_t id, bool update) {
+    Point p = set->slots[id].point;
+    int level = set->slots[id].level;
+    int64_t x = cell_coordinate(p.x, level);
+    int64_t y = cell_coordinate(p.y, level);
+    size_t closest = NO_POINT;
+    double closest_sq = INFINITY;
+    /* The points in cells at least as large as the point's own are in the unsplit cells that
+     * contain the 3x3 block of cells around it on its level.
+     */
+    const GridCell* seen[9];
+    size_t num_seen = 0;
+    bool finer = false;
+    for (int k = 0; k < 9; k++) {
+        int l = level;
+        int64_t cx = x + block_offsets[k][0], cy = y + block_offsets[k][1];
+        GridCell* c = cell_find(set, l, cx, cy, false);
+        while ((c == NULL || c->count == 0) && l < set->top_level) {
+            l++;
+            cx = parent_coordinate(cx);
+            cy = parent_coordinate(cy);
+            c = cell_find(set, l, cx, cy, false);
+        }
+        if (c == NULL || c->count == 0) {
+            continue;
+        }
+        if (c->split) {
+            /* Either the cell's points are on finer levels, or the block is empty there. */
+            finer |= l == level;
+            continue;
+        }
+        size_t i = 0;
+        while (i < num_seen && seen[i] != c) {
+            i++;
+        }
+        if (i == num_seen) {
+            seen[num_seen++] = c;
+            pair_scan(set, id, c, level, update, &closest, &closest_sq);
+        }
+    }
+    /* The points in smaller cells are in the 3x3 blocks around it on their levels, and each
+     * block is inside the block one level up, so stop at the first level with no split cells
+     * whose quarters could hold a point close enough.
+     */
+    for (int l = level - 1; finer; l--) {
+        finer = false;
+        x = cell_coordinate(p.x, l);
+        y = cell_coordinate(p.y, l);
+        for (int k = 0; k < 9; k++) {
+            int64_t cx = x + block_offsets[k][0], cy = y + block_offsets[k][1];
+            GridCell* c = cell_find(set, l, cx, cy, false);
+            if (c == NULL || c->count == 0) {
+                continue;
+            }
+            if (!c->split) {
+                pair_scan(set, id, c, l, update, &closest, &closest_sq);
+            } else if (cell_distance_squared(p, c) < ldexp(1, 2 * (l - 1))) {
+                finer = true;
+            }
+        }
+    }
+    if (closest_sq < set->slots[id].best_dist_sq) {
+        pair_set_best(set, id, closest, closest_sq);
+    }
+}
+
+
+/* Split the cell at (level, x, y), which holds more than CELL_LIMIT points, and then any of its
+ * quarters that still hold too many. This only makes cells smaller, so every best stays at least
+ * as close as the points it has to be compared with.
+ */
+static void cell_split(ClosestPairSet* set, int level, int64_t x, int64_t y) {
+    GridCell* c = cell_find(set, level, x, y, false);
+    CellEntry* entries = c->entries;
+    size_t count = c->count;
+    bool all_equal = true;
+    for (size_t i = 1; i < count; i++) {
+        all_equal &= entries[i].point.x == entries[0].point.x
+                     && entries[i].point.y == entries[0].point.y;
+    }
+    if (all_equal || level <= set->top_level - MAX_CELL_DEPTH) {
+        return;
+    }
+    c->split = true;
+    c->entries = NULL;
+    c->entries_capacity = 0;
+    for (size_t i = 0; i < count; i++) {
+        Point p = entries[i].point;
+        cell_append(set, cell_get(set, level - 1, cell_coordinate(p.x, level - 1),
+                                  cell_coordinate(p.y, level - 1)), entries[i].id);
+    }
+    free(entries);
+    for (int64_t dx = 0; dx <= 1; dx++) {
+        for (int64_t dy = 0; dy <= 1; dy++) {
+            GridCell* child = cell_find(set, level - 1, 2*x + dx, 2*y + dy, false);
+            if (child != NULL && child->count > CELL_LIMIT) {
+                cell_split(set, level - 1, 2*x + dx, 2*y + dy);
+            }
+        }
+    }
+}
+
+
+/* Empty the cell at (level, x, y) and the cells below it, and append the ids of their points to
+ * `ids`, starting at index `len`. Return the new length.
+ */
+static size_t cell_gather(ClosestPairSet* set, int level, int64_t x, int64_t y, size_t ids[],
+                          size_t len) {
+    GridCell* c = cell_find(set, level, x, y, false);
+    if (c == NULL || c->count == 0) {
+        return len;
+    }
+    if (c->split) {
+        for (int64_t dx = 0; dx <= 1; dx++) {
+            for (int64_t dy = 0; dy <= 1; dy++) {
+                len = cell_gather(set, level - 1, 2*x + dx, 2*y + dy, ids, len);
+            }
+        }
+    } else {
+        for (size_t i = 0; i < c->count; i++) {
+            ids[len++] = c->entries[i].id;
+        }
+    }
+    c->count = 0;
+    return len;
+}
+
+
+/* Merge the split cell at (level, x, y) back into one. Its points are now compared with points
+ * further away, so search for their bests again.
+ */
+static void cell_merge(ClosestPairSet* set, int level, int64_t x, int64_t y) {
+    size_t ids[CELL_MERGE_LIMIT];
+    size_t len = cell_gather(set, level, x, y, ids, 0);
+    GridCell* c = cell_find(set, level, x, y, false);
+    c->split = false;
+    for (size_t i = 0; i < len; i++) {
+        cell_append(set, c, ids[i]);
+    }
+    for (size_t i = 0; i < len; i++) {
+        pair_search(set, ids[i], true);
+    }
+}
+
+
+/* Add a level of top cells above the current ones. */
+static void cell_grow_top(ClosestPairSet* set) {
+    int level = set->top_level++;
+    for (int64_t x = -1; x <= 0; x++) {
+        for (int64_t y = -1; y <= 0; y++) {
+            /* Each new top cell contains only the old top cell with the same coordinates. */
+            GridCell* c = cell_find(set, level, x, y, false);
+            if (c == NULL || c->count == 0) {
+                continue;
+            }
+            size_t count = c->count;
+            c = cell_get(set, level + 1, x, y);
+            c->count = count;
+            c->split = true;
+            if (count <= CELL_MERGE_LIMIT) {
+                cell_merge(set, level + 1, x, y);
+            }
+        }
+    }
+}
+
+
+size_t closest_pair_set_insert(ClosestPairSet* set, Point p) {
+    size_t id = set->free_slot;
+    if (id != NO_POINT) {
+        set->free_slot = set->slots[id].next;
+    } else {
+        if (set->num_slots == set->slots_capacity) {
+            set->slots_capacity = set->slots_capacity > 0 ? 2 * set->slots_capacity : 16;
+            set->slots = safe_realloc(set->slots, set->slots_capacity * sizeof *set->slots);
+        }
+        id = set->num_slots++;
+        set->slots[id].generation = 0;
+    }
+    PointSlot* slot = &set->slots[id];
+    slot->point = p;
+    slot->alive = true;
+    slot->best = NO_POINT;
+    slot->best_dist_sq = INFINITY;
+    slot->watchers = NO_POINT;
+    double width = 4 * fmax(fabs(p.x), fabs(p.y));
+    if (set->n == 0) {
+        /* Start over with top cells sized to the first point. */
+        cells_clear(set);
+        set->heap_len = 0;
+        frexp(width, &set->top_level);
+    }
+    while (width >= ldexp(1, set->top_level)) {
+        cell_grow_top(set);
+    }
+    set->n++;
+    int level = set->top_level;
+    GridCell* c = cell_get(set, level, cell_coordinate(p.x, level), cell_coordinate(p.y, level));
+    while (c->split) {
+        c->count++;
+        level--;
+        c = cell_get(set, level, cell_coordinate(p.x, level), cell_coordinate(p.y, level));
+    }
+    cell_append(set, c, id);
+    if (c->count > CELL_LIMIT) {
+        cell_split(set, level, c->x, c->y);
+    }
+    pair_search(set, id, true);
+    pair_heap_settle(set);
+    return id;
+}
+
+
+void closest_pair_set_remove(ClosestPairSet* set, size_t id) {
+    if (id >= set->num_slots || !set->slots[id].alive) {
+        return;
+    }
+    pair_set_best(set, id, NO_POINT, INFINITY);
+    /* Take the point out of the cells that contain it, and find the largest split one that is
+     * left with few enough points to merge.
+     */
+    Point p = set->slots[id].point;
+    int leaf_level = set->slots[id].level;
+    int merge_level = leaf_level;
+    for (int level = set->top_level; level >= leaf_level; level--) {
+        GridCell* c = cell_find(set, level, cell_coordinate(p.x, level),
+                                cell_coordinate(p.y, level), false);
+        if (--c->count <= CELL_MERGE_LIMIT && c->split && merge_level == leaf_level) {
+            merge_level = level;
+        }
+        if (!c->split) {
+            size_t index = set->slots[id].index;
+            c->entries[index] = c->entries[c->count];
+            set->slots[c->entries[index].id].index = index;
+        }
+    }
+    set->slots[id].alive = false;
+    set->slots[id].generation++;
+    set->slots[id].next = set->free_slot;
+    set->free_slot = id;
+    set->n--;
+    /* The points whose best was this one search for a new one, before a merge could give them a
+     * closer one that is not the closest.
+     */
+    while (set->slots[id].watchers != NO_POINT) {
+        size_t other = set->slots[id].watchers;
+        pair_set_best(set, other, NO_POINT, INFINITY);
+        pair_search(set, other, false);
+    }
+    if (merge_level != leaf_level) {
+        cell_merge(set, merge_level, cell_coordinate(p.x, merge_level),
+                   cell_coordinate(p.y, merge_level));
+    }
+    pair_heap_settle(set);
+}
+
+
+double closest_pair_set_query(const ClosestPairSet* set, size_t* a, size_t* b) {
+    if (set->n < 2) {
+        return INFINITY;
+    }
+    if (a != NULL) *a = set->heap[0].a;
+    if (b != NULL) *b = set->heap[0].b;
+    return sqrt(set->heap[0].dist_sq);
+}
+
+
+/* Fit lines to the sorted `keys` so that each distinct key's first position is within `max_error`
+ * of its segment's prediction, and return the segments, storing how many there are in `len`.
+ *
+ * Each segment is grown greedily: every further key narrows the range of slopes that keep every
+ * key so far within the error, and the segment ends at the first key that would make that range
+ * empty (the "shrinking cone" method).
+ */
+static IndexSegment* fit_segments(const int keys[], size_t n, size_t max_error, size_t* len) {
+    size_t capacity = 16;
+    IndexSegment* segments = safe_malloc(capacity * sizeof *segments);
+    *len = 0;
+    size_t i = 0;
+    while (i < n) {
+        size_t start = i++;
+        double min_slope = 0, max_slope = INFINITY;
+        for (; i < n; i++) {
+            if (keys[i] == keys[i-1]) continue;
+            double dk = (double)keys[i] - keys[start];
+            double dp = (double)(i - start);
+            double low = (dp - (double)max_error) / dk, high = (dp + (double)max_error) / dk;
+            if (low > max_slope || high < min_slope) break;
+            if (low > min_slope) min_slope = low;
+            if (high < max_slope) max_slope = high;
+        }
+        if (*len == capacity) {
+            capacity *= 2;
+            segments = safe_realloc(segments, capacity * sizeof *segments);
+        }
+        segments[*len].key = keys[start];
+        segments[*len].slope = max_slope == INFINITY ? 0 : (min_slope + max_slope) / 2;
+        segments[*len].position = start;
+        (*len)++;
+    }
+    return segments;
+}
+
+
+/* Build a learned index over the sorted keys.
+ *
+ *   Idea: Smoothly distributed keys are well described by a few straight lines from key to
+ *   position. Fit segments that each predict the positions of a range of keys to within
+ *   max_error, and then, since the segments are themselves a sorted array of keys, fit segments to
+ *   those in turn, until a single segment is left (as in a PGM index). A lookup goes down the
+ *   levels, using each segment's prediction to pick the segment on the next level down from a
+ *   window of 2 * max_error + 1 of them, and then the position in the keys from a window of the
+ *   same size. Unlike binary search, which jumps all over the array, each lookup only reads a few
+ *   small windows, which are each a cache line or two when max_error is small.
+ *
+ *   Time analysis: O(n) to build, and O(L log max_error) per lookup, where L is the number of
+ *   levels, which is O(log n) in the worst case and usually 2 or 3.
+ *
+ *   Space analysis: O(n / max_error) for smooth keys, and O(n) in the worst case.
+ */
+LearnedIndex* learned_index_new(const int keys[], size_t n, size_t max_error) {
+    LearnedIndex* ret = safe_malloc(sizeof *ret);
+    ret->keys = keys;
+    ret->n = n;
+    ret->max_error = max_error;
+    ret->num_levels = 0;
+    ret->levels = NULL;
+    ret->level_lens = NULL;
+    const int* level_keys = keys;
+    size_t level_n = n;
+    int* segment_keys = NULL;
+    while (level_n > 0) {
+        size_t len;
+        IndexSegment* segments = fit_segments(level_keys, level_n, max_error, &len);
+        ret->levels = safe_realloc(ret->levels, (ret->num_levels + 1) * sizeof *ret->levels);
+        ret->level_lens = safe_realloc(ret->level_lens,
+                                       (ret->num_levels + 1) * sizeof *ret->level_lens);
+        ret->levels[ret->num_levels] = segments;
+        ret->level_lens[ret->num_levels++] = len;
+        if (len == 1) break;
+        /* Any two keys are on a line, so each level has at most half as many segments. */
+        segment_keys = safe_realloc(segment_keys, len * sizeof *segment_keys);
+        for (size_t i = 0; i < len; i++) {
+            segment_keys[i] = segments[i].key;
+        }
+        level_keys = segment_keys;
+        level_n = len;
+    }
+    free(segment_keys);
+    return ret;
+}
+
+
+void learned_index_free(LearnedIndex* index) {
+    if (index == NULL) return;
+    for (size_t i = 0; i < index->num_levels; i++) {
+        free(index->levels[i]);
+    }
+    free(index->levels);
+    free(index->level_lens);
+    free(index);
+}
+
+
+long long learned_index_search(const LearnedIndex* index, int datum) {
+    if (index->n == 0 || datum < index->keys[0]) {
+        return -1;
+    }
+    /* The extra 2 positions on each side cover rounding in the predictions. */
+    size_t error = index->max_error + 2;
+    size_t segment = 0;
+    for (size_t level = index->num_levels; level-- > 0; ) {
+        const IndexSegment* s = &index->levels[level][segment];
+        size_t below_len = level == 0 ? index->n : index->level_lens[level-1];
+        /* The segment only covers the positions up to the next segment's first position. */
+        size_t first = s->position;
+        size_t last = segment + 1 < index->level_lens[level] ? s[1].position - 1 : below_len - 1;
+        double guess = (double)first + s->slope * ((double)datum - s->key);
+        size_t predicted = guess >= (double)last ? last : (size_t)guess;
+        size_t start = predicted > first + error ? predicted - error : first;
+        size_t end = predicted + error < last ? predicted + error + 1 : last + 1;
+        if (level > 0) {
+            /* Find the last segment in the window whose first key is at most the datum. */
+            const IndexSegment* below = index->levels[level-1];
+            size_t low = start + 1, high = end;
+            while (low < high) {
+                size_t mid = low + (high - low) / 2;
+                if (below[mid].key <= datum) {
+                    low = mid + 1;
+                } else {
+                    high = mid;
+                }
+            }
+            segment = low - 1;
+        } else {
+            /* Find the first key in the window that is at least the datum. */
+            size_t low = start, high = end;
+            while (low < high) {
+                size_t mid = low + (high - low) / 2;
+                if (index->keys[mid] < datum) {
+                    low = mid + 1;
+                } else {
+                    high = mid;
+                }
+            }
+            return low < end && index->keys[low] == datum ? (long long)low : -1;
+        }
+    }
+    return -1;
+}
+
+
+typedef void argsort_f(const int*, size_t, uint32_t*);
+
+/* Return 1 if `f` produces a valid (and, if `stable` is set, stable) permutation for a test array
+ * with duplicate and negative keys, and 0 otherwise.
+ */
+static int test_argsort_f(argsort_f f, bool stable) {
+    int keys[] = {5, -3, 5, 0, -3, 2147483647, -2147483647 - 1, 5, 0};
+    size_t n = 9;
+    uint32_t perm[9];
+    f(keys, n, perm);
+    bool seen[9] = {false};
+    for (size_t i = 0; i < n; i++) {
+        if (perm[i] >= n || seen[perm[i]]) return 0;
+        seen[perm[i]] = true;
+        if (i > 0 && keys[perm[i-1]] > keys[perm[i]]) return 0;
+        if (stable && i > 0 && keys[perm[i-1]] == keys[perm[i]] && perm[i-1] > perm[i]) return 0;
+    }
+    return 1;
+}
+
+
+int ch07_tests() {
+    puts("\n=== CHAPTER 7 TESTS ===");
+    int tests_failed = 0;
+
+    /* RADIX SORT */
+    puts("Testing radix sort");
+    uint64_t radix_data[] = {UINT64_MAX, 0, 1ULL << 40, 255, 256, 1ULL << 40, 7};
+    radix_sort_u64(radix_data, 7);
+    int radix_ok = 1;
+    for (size_t i = 0; i + 1 < 7; i++) {
+        radix_ok &= radix_data[i] <= radix_data[i+1];
+    }
+    ASSERT(radix_ok);
+    ASSERT(radix_data[0] == 0 && radix_data[6] == UINT64_MAX);
+
+    /* ARGSORT */
+    puts("Testing argsort");
+    ASSERT(test_argsort_f(argsort, false));
+    ASSERT(test_argsort_f(argsort_stable, true));
+    ASSERT(test_argsort_f(argsort_packed, true));
+
+    /* GATHER */
+    puts("Testing gather");
+    int column_keys[] = {30, 10, 20};
+    double column_values[] = {3.5, 1.5, 2.5};
+    uint32_t column_perm[3];
+    double gathered[3];
+    argsort_packed(column_keys, 3, column_perm);
+    gather(column_values, sizeof *column_values, column_perm, 3, gathered);
+    ASSERT(gathered[0] == 1.5 && gathered[1] == 2.5 && gathered[2] == 3.5);
+    int gathered_keys[3];
+    gather(column_keys, sizeof *column_keys, column_perm, 3, gathered_keys);
+    ASSERT(array_eq(3, gathered_keys, 10, 20, 30));
+
+    /* DYNAMIC CLOSEST PAIR */
+    puts("Testing dynamic closest pair");
+    ClosestPairSet* point_set = closest_pair_set_new();
+    ASSERT(closest_pair_set_query(point_set, NULL, NULL) == INFINITY);
+    size_t point_ids[200];
+    Point live_points[200];
+    size_t num_ids = 0;
+    unsigned int state = 7;
+    int dynamic_ok = 1;
+    for (int step = 0; step < 1500; step++) {
+        state = state * 1103515245 + 12345;
+        if (num_ids < 200 && (num_ids < 2 || (state >> 16) % 3 != 0)) {
+            /* Alternate between a coarse range, where duplicates are common, and a wide one. */
+            int range = step % 500 < 250 ? 50 : 100000;
+            Point p = { (double)((state >> 4) % range), (double)((state >> 12) % range) };
+            point_ids[num_ids++] = closest_pair_set_insert(point_set, p);
+        } else {
+            size_t i = (state >> 8) % num_ids;
+            closest_pair_set_remove(point_set, point_ids[i]);
+            point_ids[i] = point_ids[--num_ids];
+        }
+        for (size_t i = 0; i < num_ids; i++) {
+            live_points[i] = point_set->slots[point_ids[i]].point;
+        }
+        size_t a = 0, b = 0;
+        double d = closest_pair_set_query(point_set, &a, &b);
+        dynamic_ok &= num_ids < 2 ? d == INFINITY
+                      : d == closest_pair_brute_force(live_points, num_ids)
+                        && a != b && point_set->slots[a].alive && point_set->slots[b].alive
+                        && d == sqrt(distance_squared(point_set->slots[a].point,
+                                                      point_set->slots[b].point));
+    }
+    ASSERT(dynamic_ok);
+    closest_pair_set_free(point_set);
+
+    /* Inserting a point much closer to another than the closest pair and removing it again keeps
+     * the old closest pair, and only compacts the heap every so often.
+     */
+    point_set = closest_pair_set_new();
+    for (int i = 0; i < 1024; i++) {
+        closest_pair_set_insert(point_set, (Point){ 10.0 * (i % 32), 10.0 * (i / 32) });
+    }
+    size_t lattice_compactions = point_set->compactions;
+    int near_ok = closest_pair_set_query(point_set, NULL, NULL) == 10;
+    for (int step = 0; step < 2000; step++) {
+        Point near = { 10.0 * (step % 32) + 0.001 * (step % 7 + 1), 10.0 * (step % 29) };
+        size_t id = closest_pair_set_insert(point_set, near);
+        Point other = { 10.0 * (step % 32), 10.0 * (step % 29) };
+        near_ok &= closest_pair_set_query(point_set, NULL, NULL)
+                   == sqrt(distance_squared(near, other));
+        closest_pair_set_remove(point_set, id);
+        near_ok &= closest_pair_set_query(point_set, NULL, NULL) == 10;
+    }
+    ASSERT(near_ok);
+    ASSERT(point_set->compactions - lattice_compactions <= 4000 / 128);
+
+    /* Crowding points into a small area and then draining them again splits and merges the cells
+     * there, and the heap is compacted at most once every n/8 updates.
+     */
+    size_t crowd_ids[100];
+    Point crowd_points[1024 + 100];
+    for (int i = 0; i < 1024; i++) {
+        crowd_points[i] = (Point){ 10.0 * (i % 32), 10.0 * (i / 32) };
+    }
+    size_t crowd_compactions = point_set->compactions;
+    int crowd_ok = 1;
+    for (int round = 0; round < 20; round++) {
+        Point center = { 10.0 * (round % 32) + 5, 10.0 * (round % 31) + 5 };
+        for (int i = 0; i < 100; i++) {
+            state = state * 1103515245 + 12345;
+            Point p = { center.x + 0.0001 * ((state >> 8) % 1000),
+                        center.y + 0.0001 * ((state >> 18) % 1000) };
+            crowd_points[1024 + i] = p;
+            crowd_ids[i] = closest_pair_set_insert(point_set, p);
+        }
+        crowd_ok &= closest_pair_set_query(point_set, NULL, NULL)
+                    == closest_pair_brute_force(crowd_points, 1024 + 100);
+        for (int i = 99; i >= 0; i--) {
+            closest_pair_set_remove(point_set, crowd_ids[i]);
+            if (i % 50 == 0) {
+                crowd_ok &= closest_pair_set_query(point_set, NULL, NULL)
+                            == closest_pair_brute_force(crowd_points, 1024 + (size_t)i);
+            }
+        }
+        crowd_ok &= closest_pair_set_query(point_set, NULL, NULL) == 10;
+    }
+    ASSERT(crowd_ok);
+    ASSERT(point_set->compactions - crowd_compactions <= 20 * 200 / (1024 / 8));
+    closest_pair_set_free(point_set);
+
+    /* LEARNED INDEX */
+    puts("Testing learned index");
+    int small_keys[] = {-5, 0, 0, 0, 2, 7, 7, 100};
+    LearnedIndex* index = learned_index_new(small_keys, 8, 1);
+    ASSERT(learned_index_search(index, -5) == 0);
+    ASSERT(learned_index_search(index, 0) == 1);
+    ASSERT(learned_index_search(index, 2) == 4);
+    ASSERT(learned_index_search(index, 7) == 5);
+    ASSERT(learned_index_search(index, 100) == 7);
+    ASSERT(learned_index_search(index, -6) == -1);
+    ASSERT(learned_index_search(index, 3) == -1);
+    ASSERT(learned_index_search(index, 101) == -1);
+    learned_index_free(index);
+    index = learned_index_new(small_keys, 0, 4);
+    ASSERT(learned_index_search(index, 0) == -1);
+    learned_index_free(index);
+
+    /* Distinct keys whose gaps grow and shrink, so that they need many segments, looked up at
+     * every key and every gap with several error bounds.
+     */
+    size_t index_n = 100000;
+    int* index_keys = safe_malloc(index_n * sizeof *index_keys);
+    unsigned int index_state = 5;
+    index_keys[0] = -2147483647 - 1;
+    for (size_t i = 1; i < index_n; i++) {
+        index_state = index_state * 1103515245 + 12345;
+        int gap = i % 20000 < 10000 ? 1 + (int)((index_state >> 16) % 16) : 20000;
+        index_keys[i] = index_keys[i-1] + gap;
+    }
+    size_t error_bounds[] = { 0, 4, 64 };
+    size_t previous_size = SIZE_MAX;
+    for (size_t e = 0; e < sizeof error_bounds / sizeof error_bounds[0]; e++) {
+        index = learned_index_new(index_keys, index_n, error_bounds[e]);
+        int index_ok = 1;
+        for (size_t i = 0; i < index_n; i++) {
+            index_ok &= learned_index_search(index, index_keys[i]) == (long long)i;
+            index_ok &= learned_index_search(index, index_keys[i] + 1) == -1
+                        || (i + 1 < index_n && index_keys[i] + 1 == index_keys[i+1]);
+        }
+        ASSERT(index_ok);
+        ASSERT(index->level_lens[index->num_levels - 1] == 1);
+        ASSERT(index->level_lens[0] < previous_size);
+        previous_size = index->level_lens[0];
+        learned_index_free(index);
+    }
+    free(index_keys);
+
+    return tests_failed;
+}
@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <string.h>
+#include "algorithms.h"
+
+
+/* The number of 64-bit words of each row that transitive_closure updates at a time. The 64 pivot
+ * rows of a block then take up 64 * 32 * 8 bytes = 16 KiB, which fits in the L1 cache.
+ */
+#define CLOSURE_TILE_WORDS 32
+
+
+/* Replace the adjacency matrix with its transitive closure, which has an edge from i to j if and
+ * only if the original graph has a path of one or more edges from i to j.
+ *
+ *   Idea: Warshall's algorithm: for each vertex k in turn, every vertex i with an edge to k gets an
+ *   edge to everything that k has an edge to. With the rows stored as bitsets, that is an OR of
+ *   row k into row i, one word (64 columns) at a time.
+ *
+ *   To keep the rows being ORed in cache, the vertices k are processed in blocks of 64, the columns
+ *   of one word. First, Warshall's algorithm is run on just the 64 rows of the block, which only
+ *   depend on each other, so that each of them is final for the block. Then every other row i
+ *   needs exactly the block's rows k for the bits set in its word of the block before the update,
+ *   since a path from i through the block enters it for the first time at a vertex that i already
+ *   has an edge to. Those ORs are done one tile of CLOSURE_TILE_WORDS words at a time, so that the
+ *   tiles of the block's rows stay in the L1 cache while every other row is updated from them.
+ *
+ *   Time analysis: For each of the n/64 blocks, each of the n rows has up to 64 rows of n/64 words
+ *   ORed into it, so O(n^3 / 64) word operations.
+ *
+ *   Space analysis: O(n), for each row's word of the current block.
+ */
+void transitive_closure(GraphMatrix* m) {
+    size_t n = m->n, words = m->words;
+    uint64_t* masks = safe_malloc((n > 0 ? n : 1) * sizeof *masks);
+    for (size_t block = 0; block < words; block++) {
+        size_t start = 64 * block;
+        size_t end = start + 64 < n ? start + 64 : n;
+        /* Close the block's own rows. */
+        for (size_t k = start; k < end; k++) {
+            const uint64_t* row_k = MATRIX_ROW(m, k);
+            for (size_t i = start; i < end; i++) {
+                if (MATRIX_HAS_EDGE(m, i, k)) {
+                    uint64_t* row_i = MATRIX_ROW(m, i);
+                    for (size_t x = 0; x < words; x++) {
+                        row_i[x] |= row_k[x];
+                    }
+                }
+            }
+        }
+        /* Save each other row's word of the block, before the tile containing it is updated. */
+        for (size_t i = 0; i < n; i++) {
+            masks[i] = i >= start && i < end ? 0 : MATRIX_ROW(m, i)[block];
+        }
+        for (size_t tile = 0; tile < words; tile += CLOSURE_TILE_WORDS) {
+            size_t tile_end = tile + CLOSURE_TILE_WORDS < words ? tile + CLOSURE_TILE_WORDS : words;
+            for (size_t i = 0; i < n; i++) {
+                uint64_t* row_i = MATRIX_ROW(m, i);
+                for (uint64_t bits = masks[i]; bits != 0; bits &= bits - 1) {
+                    const uint64_t* row_k = MATRIX_ROW(m, start + __builtin_ctzll(bits));
+                    for (size_t x = tile; x < tile_end; x++) {
+                        row_i[x] |= row_k[x];
+                    }
+                }
+            }
+        }
+    }
+    free(masks);
+}
+
+
+int ch08_tests() {
+    puts("\n=== CHAPTER 8 TESTS ===");
+    int tests_failed = 0;
+
+    /* TRANSITIVE CLOSURE */
+    puts("Testing transitive closure");
+    Graph* g = graph_from_string(DIRECTED, "ABCDE", "AB BC CA DE");
+    GraphMatrix* m = graph_matrix_from_graph(g);
+    transitive_closure(m);
+    int small_ok = 1;
+    const char* expected[] = { "11100", "11100", "11100", "00001", "00000" };
+    for (size_t i = 0; i < 5; i++) {
+        for (size_t j = 0; j < 5; j++) {
+            small_ok &= (int)MATRIX_HAS_EDGE(m, i, j) == expected[i][j] - '0';
+        }
+    }
+    ASSERT(small_ok);
+    graph_matrix_free(m);
+    graph_free(g);
+
+    /* A sparse random graph that spans several blocks and ends partway through a word, checked
+     * against Warshall's algorithm on a matrix of bools and against breadth-first search.
+     */
+    size_t n = 150;
+    m = graph_matrix_new(n);
+    bool* reference = safe_calloc(n * n, sizeof *reference);
+    unsigned int state = 3;
+    for (size_t e = 0; e < 200; e++) {
+        state = state * 1103515245 + 12345;
+        size_t i = (state >> 8) % n;
+        state = state * 1103515245 + 12345;
+        size_t j = (state >> 8) % n;
+        graph_matrix_add_edge(m, i, j);
+        reference[i*n + j] = true;
+    }
+    int* levels = breadth_first_search_matrix(m, 0);
+    transitive_closure(m);
+    for (size_t k = 0; k < n; k++) {
+        for (size_t i = 0; i < n; i++) {
+            if (reference[i*n + k]) {
+                for (size_t j = 0; j < n; j++) {
+                    reference[i*n + j] |= reference[k*n + j];
+                }
+            }
+        }
+    }
+    int closure_ok = 1, reachable_ok = 1;
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j < n; j++) {
+            closure_ok &= (bool)MATRIX_HAS_EDGE(m, i, j) == reference[i*n + j];
+        }
+    }
+    for (size_t j = 1; j < n; j++) {
+        reachable_ok &= (bool)MATRIX_HAS_EDGE(m, 0, j) == (levels[j] > 0);
+    }
+    ASSERT(closure_ok);
+    ASSERT(reachable_ok);
+    free(levels);
+    free(reference);
+    graph_matrix_free(m);
+
+    return tests_failed;
+}
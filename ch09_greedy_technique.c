@@ -0,0 +1,402 @@
+#include <stdlib.h>
+#include <string.h>
+#include "algorithms.h"
+
+
+/* The number of vertices that a thread of connected_components claims at a time. */
+#define COMPONENTS_CHUNK 4096
+
+/* The number of edges that a thread of connected_components merges by itself from each chunk of
+ * vertices it claims, and the number of edges in each slice of the rest.
+ */
+#define COMPONENTS_SLICE 65536
+
+
+DisjointSets* disjoint_sets_new(size_t n) {
+    DisjointSets* ret = safe_malloc(sizeof *ret);
+    ret->n = n;
+    ret->parents = safe_malloc((n > 0 ? n : 1) * sizeof *ret->parents);
+    for (size_t i = 0; i < n; i++) {
+        ret->parents[i] = i;
+    }
+    return ret;
+}
+
+
+void disjoint_sets_free(DisjointSets* s) {
+    if (s == NULL) return;
+    free(s->parents);
+    free(s);
+}
+
+
+/* Return the root of the tree containing `x`.
+ *
+ *   Idea: Follow the parents up to the root, and on the way, point each element at its grandparent
+ *   (path splitting), so that later finds take about half as many steps. The update is a
+ *   compare-and-swap that is simply dropped if another thread changed the parent in the meantime,
+ *   since every parent is always an ancestor of the element, and so is the grandparent.
+ *
+ *   Time analysis: O(log n) amortized, since elements are linked by index rather than by size or
+ *   rank. In practice the splitting keeps the trees almost flat.
+ *
+ *   Space analysis: O(1).
+ */
+size_t disjoint_sets_find(DisjointSets* s, size_t x) {
+    for (;;) {
+        size_t parent = __atomic_load_n(&s->parents[x], __ATOMIC_RELAXED);
+        size_t grandparent = __atomic_load_n(&s->parents[parent], __ATOMIC_RELAXED);
+        if (parent == grandparent) {
+            return parent;
+        }
+        __atomic_compare_exchange_n(&s->parents[x], &parent, grandparent, true, __ATOMIC_RELAXED,
+                                    __ATOMIC_RELAXED);
+        x = parent;
+    }
+}
+
+
+/* Merge the sets containing `x` and `y`.
+ *
+ *   Idea: Find both roots, and make the larger one a child of the smaller one with a
+ *   compare-and-swap that only succeeds if the larger one is still a root. If another thread
+ *   linked it first, find the roots again and retry. Since a root is only ever linked below a
+ *   smaller element, the links can never form a cycle, and the root of each set is its smallest
+ *   element no matter what order the threads merge in.
+ *
+ *   Time analysis: O(log n) amortized per attempt, as for disjoint_sets_find.
+ *
+ *   Space analysis: O(1).
+ */
+bool disjoint_sets_union(DisjointSets* s, size_t x, size_t y) {
+    for (;;) {
+        x = disjoint_sets_find(s, x);
+        y = disjoint_sets_find(s, y);
+        if (x == y) {
+            return false;
+        }
+        if (x < y) {
+            size_t t = x;
+            x = y;
+            y = t;
+        }
+        size_t expected = x;
+        if (__atomic_compare_exchange_n(&s->parents[x], &expected, y, false, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED)) {
+            return true;
+        }
+    }
+}
+
+
+/* A range of up to COMPONENTS_SLICE consecutive edges, in the order of the adjacency lists one
+ * after another: `edges` edges starting at `first`, which is in the list of vertex `v`, and
+ * continuing into the lists of the next vertices if that one ends first.
+ */
+typedef struct {
+    size_t v;
+    VertexList* first;
+    size_t edges;
+} EdgeSlice;
+
+
+/* One thread's share of the work of connected_components. */
+typedef struct {
+    const Graph* g;
+    DisjointSets* sets;
+    /* The first vertex that no thread has claimed yet, shared by all the threads. */
+    size_t* next_vertex;
+    /* The slices of edges that this thread left to be merged by all the threads. */
+    EdgeSlice* slices;
+    size_t num_slices, slices_capacity;
+    /* The slices of all the threads, and the first one that no thread has merged yet. */
+    const EdgeSlice* all_slices;
+    size_t total_slices;
+    size_t* next_slice;
+} ComponentsTask;
+
+
+static void push_slice(ComponentsTask* task, EdgeSlice slice) {
+    if (task->num_slices == task->slices_capacity) {
+        task->slices_capacity = task->slices_capacity > 0 ? 2 * task->slices_capacity : 16;
+        task->slices = safe_realloc(task->slices, task->slices_capacity * sizeof *task->slices);
+    }
+    task->slices[task->num_slices++] = slice;
+}
+
+
+static void* merge_chunk_edges(void* arg) {
+    ComponentsTask* task = arg;
+    const Graph* g = task->g;
+    for (;;) {
+        size_t start = __atomic_fetch_add(task->next_vertex, COMPONENTS_CHUNK, __ATOMIC_RELAXED);
+        if (start >= g->n) break;
+        size_t end = start + COMPONENTS_CHUNK < g->n ? start + COMPONENTS_CHUNK : g->n;
+        size_t budget = COMPONENTS_SLICE;
+        EdgeSlice slice = { 0, NULL, 0 };
+        for (size_t v = start; v < end; v++) {
+            for (VertexList* p = g->vertices[v].neighbors; p != NULL; p = p->next) {
+                if (budget > 0) {
+                    budget--;
+                    disjoint_sets_union(task->sets, v, (size_t)(p->v - g->vertices));
+                    continue;
+                }
+                if (slice.edges == 0) {
+                    slice.v = v;
+                    slice.first = p;
+                }
+                if (++slice.edges == COMPONENTS_SLICE) {
+                    push_slice(task, slice);
+                    slice.edges = 0;
+                }
+            }
+        }
+        if (slice.edges > 0) {
+            push_slice(task, slice);
+        }
+    }
+    return NULL;
+}
+
+
+static void* merge_slice_edges(void* arg) {
+    ComponentsTask* task = arg;
+    const Graph* g = task->g;
+    for (;;) {
+        size_t i = __atomic_fetch_add(task->next_slice, 1, __ATOMIC_RELAXED);
+        if (i >= task->total_slices) break;
+        size_t v = task->all_slices[i].v;
+        VertexList* p = task->all_slices[i].first;
+        for (size_t e = 0; e < task->all_slices[i].edges; e++, p = p->next) {
+            while (p == NULL) {
+                p = g->vertices[++v].neighbors;
+            }
+            disjoint_sets_union(task->sets, v, (size_t)(p->v - g->vertices));
+        }
+    }
+    return NULL;
+}
+
+
+/* Return a malloc'd array of the connected component of each vertex of `g`.
+ *
+ *   Idea: Instead of searching from each unvisited vertex in turn, which can only be done one
+ *   search at a time, start with every vertex in a set of its own and merge the sets at the two
+ *   ends of each edge. The threads claim COMPONENTS_CHUNK vertices at a time and merge along the
+ *   first COMPONENTS_SLICE edges of their lists. Most chunks have no more edges than that, so
+ *   their lists are walked just once. The rest of the edges of a chunk, such as those of a vertex
+ *   with a huge list, are cut into slices of COMPONENTS_SLICE edges that the threads then claim one
+ *   at a time, so that they are merged by all the threads rather than by the one that found them.
+ *   Afterwards, the root of each set is its smallest vertex, so numbering the roots in order gives
+ *   the same numbers that searching from each unvisited vertex in order would.
+ *
+ *   Time analysis: O(|V| + |E| log |V|) work in the worst case, and close to O(|V| + |E|) in
+ *   practice, divided among the threads.
+ *
+ *   Space analysis: O(|V| + |E| / COMPONENTS_SLICE).
+ */
+int* connected_components(const Graph* g, size_t* num_components, int num_threads) {
+    size_t n = g->n;
+    DisjointSets* sets = disjoint_sets_new(n);
+    size_t chunks = (n + COMPONENTS_CHUNK - 1) / COMPONENTS_CHUNK;
+    if (num_threads < 1) num_threads = 1;
+    if ((size_t)num_threads > chunks) num_threads = chunks > 0 ? (int)chunks : 1;
+    size_t next_vertex = 0, next_slice = 0;
+    ComponentsTask* tasks = safe_malloc(num_threads * sizeof *tasks);
+    for (int i = 0; i < num_threads; i++) {
+        tasks[i] = (ComponentsTask){ g, sets, &next_vertex, NULL, 0, 0, NULL, 0, &next_slice };
+    }
+    run_in_parallel(merge_chunk_edges, tasks, sizeof *tasks, num_threads);
+    size_t total_slices = 0;
+    for (int i = 0; i < num_threads; i++) {
+        total_slices += tasks[i].num_slices;
+    }
+    EdgeSlice* slices = safe_malloc((total_slices > 0 ? total_slices : 1) * sizeof *slices);
+    total_slices = 0;
+    for (int i = 0; i < num_threads; i++) {
+        memcpy(slices + total_slices, tasks[i].slices, tasks[i].num_slices * sizeof *slices);
+        total_slices += tasks[i].num_slices;
+        free(tasks[i].slices);
+    }
+    for (int i = 0; i < num_threads; i++) {
+        tasks[i].all_slices = slices;
+        tasks[i].total_slices = total_slices;
+    }
+    run_in_parallel(merge_slice_edges, tasks, sizeof *tasks, num_threads);
+    free(slices);
+    free(tasks);
+
+    int* components = safe_malloc((n > 0 ? n : 1) * sizeof *components);
+    *num_components = 0;
+    for (size_t v = 0; v < n; v++) {
+        size_t root = disjoint_sets_find(sets, v);
+        /* The root is at or before v, so it already has its number. */
+        components[v] = root == v ? (int)(*num_components)++ : components[root];
+    }
+    disjoint_sets_free(sets);
+    return components;
+}
+
+
+/* The components of an undirected graph found by depth-first search from each unvisited vertex in
+ * turn, to test connected_components against.
+ */
+static int* components_by_search(const Graph* g) {
+    int* components = safe_malloc((g->n > 0 ? g->n : 1) * sizeof *components);
+    size_t* stack = safe_malloc((g->n > 0 ? g->n : 1) * sizeof *stack);
+    for (size_t v = 0; v < g->n; v++) {
+        components[v] = -1;
+    }
+    int count = 0;
+    for (size_t s = 0; s < g->n; s++) {
+        if (components[s] != -1) continue;
+        size_t len = 0;
+        stack[len++] = s;
+        components[s] = count;
+        while (len > 0) {
+            const Vertex* v = &g->vertices[stack[--len]];
+            for (VertexList* p = v->neighbors; p != NULL; p = p->next) {
+                size_t u = (size_t)(p->v - g->vertices);
+                if (components[u] == -1) {
+                    components[u] = count;
+                    stack[len++] = u;
+                }
+            }
+        }
+        count++;
+    }
+    free(stack);
+    return components;
+}
+
+
+typedef struct {
+    DisjointSets* sets;
+    size_t start, step;
+} UnionTask;
+
+static void* union_every_step(void* arg) {
+    UnionTask* task = arg;
+    for (size_t i = task->start; i + task->step < task->sets->n; i += task->step) {
+        disjoint_sets_union(task->sets, i + task->step, i);
+    }
+    return NULL;
+}
+
+
+int ch09_tests() {
+    puts("\n=== CHAPTER 9 TESTS ===");
+    int tests_failed = 0;
+
+    /* DISJOINT SETS */
+    puts("Testing disjoint sets");
+    DisjointSets* sets = disjoint_sets_new(10);
+    ASSERT(disjoint_sets_union(sets, 3, 7));
+    ASSERT(disjoint_sets_union(sets, 9, 7));
+    ASSERT(!disjoint_sets_union(sets, 3, 9));
+    ASSERT(disjoint_sets_union(sets, 2, 5));
+    ASSERT(disjoint_sets_find(sets, 9) == 3);
+    ASSERT(disjoint_sets_find(sets, 5) == 2);
+    ASSERT(disjoint_sets_find(sets, 4) == 4);
+    ASSERT(disjoint_sets_union(sets, 9, 5));
+    ASSERT(disjoint_sets_find(sets, 7) == 2);
+    disjoint_sets_free(sets);
+
+    /* Threads that link overlapping chains of elements at once, one of which (with a step of 1)
+     * joins everything into one set, so any link lost to a race would split it.
+     */
+    size_t n = 100000;
+    sets = disjoint_sets_new(n);
+    UnionTask union_tasks[] = { { sets, 0, 1 }, { sets, 1, 2 }, { sets, 0, 3 }, { sets, 4, 7 } };
+    run_in_parallel(union_every_step, union_tasks, sizeof union_tasks[0], 4);
+    int one_set = 1;
+    for (size_t i = 0; i < n; i++) {
+        one_set &= disjoint_sets_find(sets, i) == 0;
+    }
+    ASSERT(one_set);
+    disjoint_sets_free(sets);
+
+    /* CONNECTED COMPONENTS */
+    puts("Testing connected_components");
+    Graph* g = graph_from_string(UNDIRECTED, "ABCDEFG", "AC BD CE DF");
+    size_t num_components;
+    int* components = connected_components(g, &num_components, 2);
+    ASSERT(num_components == 3);
+    ASSERT(array_eq(7, components, 0, 1, 0, 1, 0, 1, 2));
+    free(components);
+    graph_free(g);
+
+    /* Directed edges count in both directions. */
+    g = graph_from_string(DIRECTED, "ABCD", "BA CB");
+    components = connected_components(g, &num_components, 1);
+    ASSERT(num_components == 2);
+    ASSERT(array_eq(4, components, 0, 0, 0, 1));
+    free(components);
+    graph_free(g);
+
+    /* A sparse random undirected graph with many components, spanning several chunks. */
+    n = 50000;
+    g = graph_new(n);
+    unsigned int state = 11;
+    for (size_t e = 0; e < n / 2; e++) {
+        state = state * 1103515245 + 12345;
+        size_t i = (state >> 8) % n;
+        state = state * 1103515245 + 12345;
+        size_t j = (state >> 8) % n;
+        graph_add_edge_index(g, i, j);
+        graph_add_edge_index(g, j, i);
+    }
+    int* expected = components_by_search(g);
+    int expected_count = 0;
+    for (size_t v = 0; v < n; v++) {
+        if (expected[v] >= expected_count) expected_count = expected[v] + 1;
+    }
+    int threads[] = { 1, 4 };
+    for (size_t t = 0; t < 2; t++) {
+        components = connected_components(g, &num_components, threads[t]);
+        int same = 1;
+        for (size_t v = 0; v < n; v++) {
+            same &= components[v] == expected[v];
+        }
+        ASSERT(same);
+        ASSERT(num_components == (size_t)expected_count);
+        free(components);
+    }
+    free(expected);
+    graph_free(g);
+
+    /* Two hubs in the first chunk, with more edges between them than the chunk merges by itself, so
+     * that the rest is cut into slices that run from one list into the next, past a vertex without
+     * edges.
+     */
+    n = 300000;
+    g = graph_new(n);
+    for (size_t v = 3; v < n; v += 3) {
+        graph_add_edge_index(g, 0, v);
+        graph_add_edge_index(g, v, 0);
+    }
+    for (size_t k = 0; k < COMPONENTS_SLICE; k++) {
+        graph_add_edge_index(g, 1, 5 + 3 * k);
+        graph_add_edge_index(g, 5 + 3 * k, 1);
+    }
+    for (size_t v = 7; v + 3 < n; v += 3) {
+        if (v % 7 != 0) {
+            graph_add_edge_index(g, v, v + 3);
+            graph_add_edge_index(g, v + 3, v);
+        }
+    }
+    expected = components_by_search(g);
+    for (size_t t = 0; t < 2; t++) {
+        components = connected_components(g, &num_components, threads[t]);
+        int same = 1;
+        for (size_t v = 0; v < n; v++) {
+            same &= components[v] == expected[v];
+        }
+        ASSERT(same);
+        free(components);
+    }
+    free(expected);
+    graph_free(g);
+
+    return tests_failed;
+}
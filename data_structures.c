@@ -59,14 +59,31 @@ void graph_add_edge(Graph* g, char from, char to) {
 }
 
 
-Graph* graph_from_string(enum GraphType typ, const char* vertices, const char* edges) {
+void graph_add_edge_index(Graph* g, size_t from, size_t to) {
+    VertexList* new_ptr = safe_malloc(sizeof *new_ptr);
+    new_ptr->v = &g->vertices[to];
+    new_ptr->next = g->vertices[from].neighbors;
+    g->vertices[from].neighbors = new_ptr;
+}
+
+
+Graph* graph_new(size_t n) {
     Graph* ret = safe_malloc(sizeof *ret);
-    ret->n = strlen(vertices);
-    ret->vertices = safe_malloc(ret->n * sizeof *ret->vertices);
+    ret->n = n;
+    ret->vertices = safe_malloc(n * sizeof *ret->vertices);
+    for (size_t i = 0; i < n; i++) {
+        ret->vertices[i].val = 0;
+        ret->vertices[i].neighbors = NULL;
+    }
+    return ret;
+}
+
+
+Graph* graph_from_string(enum GraphType typ, const char* vertices, const char* edges) {
+    Graph* ret = graph_new(strlen(vertices));
     /* Add the vertices. */
     for (size_t i = 0; i < ret->n; i++) {
         ret->vertices[i].val = vertices[i];
-        ret->vertices[i].neighbors = NULL;
     }
     /* Add the edges. */
     size_t i = 0;
@@ -99,11 +116,77 @@ void graph_free(Graph* g) {
 }
 
 
+GraphMatrix* graph_matrix_new(size_t n) {
+    GraphMatrix* ret = safe_malloc(sizeof *ret);
+    ret->n = n;
+    ret->words = (n + 63) / 64;
+    ret->vals = safe_calloc(n > 0 ? n : 1, sizeof *ret->vals);
+    ret->edges = safe_calloc(n * ret->words > 0 ? n * ret->words : 1, sizeof *ret->edges);
+    return ret;
+}
+
+
+void graph_matrix_add_edge(GraphMatrix* m, size_t from, size_t to) {
+    MATRIX_ROW(m, from)[to / 64] |= (uint64_t)1 << (to % 64);
+}
+
+
+GraphMatrix* graph_matrix_from_graph(const Graph* g) {
+    GraphMatrix* ret = graph_matrix_new(g->n);
+    for (size_t i = 0; i < g->n; i++) {
+        ret->vals[i] = g->vertices[i].val;
+        for (VertexList* p = g->vertices[i].neighbors; p != NULL; p = p->next) {
+            graph_matrix_add_edge(ret, i, p->v - g->vertices);
+        }
+    }
+    return ret;
+}
+
+
+Graph* graph_from_matrix(const GraphMatrix* m) {
+    Graph* ret = graph_new(m->n);
+    for (size_t i = 0; i < m->n; i++) {
+        ret->vertices[i].val = m->vals[i];
+        const uint64_t* row = MATRIX_ROW(m, i);
+        /* Edges are added to the front of the list, so add them from the last column to the first
+         * to leave each list in order.
+         */
+        for (size_t w = m->words; w-- > 0; ) {
+            uint64_t bits = row[w];
+            while (bits != 0) {
+                int b = 63 - __builtin_clzll(bits);
+                graph_add_edge_index(ret, i, 64*w + b);
+                bits &= ~((uint64_t)1 << b);
+            }
+        }
+    }
+    return ret;
+}
+
+
+void graph_matrix_free(GraphMatrix* m) {
+    if (m == NULL) return;
+    free(m->vals);
+    free(m->edges);
+    free(m);
+}
+
+
+/* Return the smallest power of two that is at least `n` (and at least 8). */
+static size_t round_up_capacity(size_t n) {
+    size_t capacity = 8;
+    while (capacity < n) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+
 VertexStack* stack_new(size_t n) {
     VertexStack* ret = safe_malloc(sizeof* ret);
-    ret->data = safe_malloc(n * sizeof *ret->data);
+    ret->capacity = round_up_capacity(n);
+    ret->data = safe_malloc(ret->capacity * sizeof *ret->data);
     ret->len = 0;
-    ret->capacity = n;
     return ret;
 }
 
@@ -120,6 +203,10 @@ Vertex* stack_pop(VertexStack* stack) {
 
 
 void stack_push(VertexStack* stack, Vertex* v) {
+    if (stack->len == stack->capacity) {
+        stack->capacity *= 2;
+        stack->data = safe_realloc(stack->data, stack->capacity * sizeof *stack->data);
+    }
     stack->data[stack->len++] = v;
 }
 
@@ -131,9 +218,9 @@ bool stack_empty(const VertexStack* stack) {
 
 VertexQueue* queue_new(size_t n) {
     VertexQueue* ret = safe_malloc(sizeof *ret);
-    ret->data = safe_malloc(n * sizeof *ret->data);
+    ret->capacity = round_up_capacity(n);
+    ret->data = safe_malloc(ret->capacity * sizeof *ret->data);
     ret->head = ret->tail = 0;
-    ret->capacity = n;
     return ret;
 }
 
@@ -145,12 +232,25 @@ void queue_free(VertexQueue* queue) {
 
 
 Vertex* queue_pop(VertexQueue* queue) {
-    return queue->data[queue->tail++ % queue->capacity];
+    return queue->data[queue->tail++ & (queue->capacity - 1)];
 }
 
 
 void queue_push(VertexQueue* queue, Vertex* v) {
-    queue->data[queue->head++ % queue->capacity] = v;
+    size_t len = queue->head - queue->tail;
+    if (len == queue->capacity) {
+        /* Unwrap the queue into the front of a buffer twice the size. */
+        Vertex** data = safe_malloc(2 * queue->capacity * sizeof *data);
+        size_t start = queue->tail & (queue->capacity - 1);
+        memcpy(data, queue->data + start, (queue->capacity - start) * sizeof *data);
+        memcpy(data + (queue->capacity - start), queue->data, start * sizeof *data);
+        free(queue->data);
+        queue->data = data;
+        queue->capacity *= 2;
+        queue->tail = 0;
+        queue->head = len;
+    }
+    queue->data[queue->head++ & (queue->capacity - 1)] = v;
 }
 
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 
 struct Vertex;
@@ -22,19 +23,172 @@ typedef struct {
 } Graph;
 
 
+/* An adjacency matrix with one bit per entry. */
 typedef struct {
     size_t n;
     char* vals;
-    /* An array of length n^2 where each true entry (i, j) indicates an edge between i and j. */
-    bool* edges;
+    /* The number of 64-bit words in each row, i.e. n / 64 rounded up. */
+    size_t words;
+    /* Row i is the `words` words starting at edges + i*words, and bit j % 64 of word j / 64 of
+     * the row is set if there is an edge from i to j. Bits past column n - 1 are always 0, so
+     * whole words can be ORed together without masking.
+     */
+    uint64_t* edges;
 } GraphMatrix;
 
+/* The row of vertex `i` of a GraphMatrix, and whether there is an edge from i to j. */
+#define MATRIX_ROW(m, i) ((m)->edges + (i) * (m)->words)
+#define MATRIX_HAS_EDGE(m, i, j) ((MATRIX_ROW(m, i)[(j) / 64] >> ((j) % 64)) & 1)
+
 
 typedef struct {
     double x, y;
 } Point;
 
 
+/* A fixed-size record that is sorted by its key, for the type-generic sorts in generic_sort.h. */
+typedef struct {
+    int64_t key;
+    int64_t payload;
+} KeyValue;
+
+
+/* A point in a ClosestPairSet. */
+typedef struct {
+    Point point;
+    /* The next slot in the free list if this slot is not in use. */
+    size_t next;
+    /* The level of the cell the point is in, and its index in the cell's entries. */
+    int level;
+    size_t index;
+    /* The closest point found to this one, or SIZE_MAX if there is none, and the squared distance
+     * to it.
+     */
+    size_t best;
+    double best_dist_sq;
+    /* The first point whose `best` is this one, and the next and previous points in that list. */
+    size_t watchers, watch_next, watch_prev;
+    /* Incremented whenever the point is removed, so that pairs found before then can be told apart
+     * from pairs with a new point in the same slot.
+     */
+    unsigned generation;
+    bool alive;
+} PointSlot;
+
+/* A copy of the parts of a PointSlot that are needed when looking through a cell. */
+typedef struct {
+    Point point;
+    double best_dist_sq;
+    size_t id;
+} CellEntry;
+
+/* A square cell of a ClosestPairSet, with sides of length 2^level. A cell that has been split
+ * holds its points in the four cells on the level below it, and otherwise it holds them in
+ * `entries`.
+ */
+typedef struct {
+    int64_t x, y;
+    int level;
+    CellEntry* entries;
+    size_t entries_capacity;
+    /* The number of points in the cell, including those in the cells below it. */
+    size_t count;
+    bool used, split;
+} GridCell;
+
+/* Two points of a ClosestPairSet, and the squared distance between them. */
+typedef struct {
+    double dist_sq;
+    size_t a, b;
+    unsigned generation_a, generation_b;
+} PointPair;
+
+/* A set of points that keeps track of its closest pair as points are inserted and removed. */
+typedef struct {
+    /* The points, indexed by the ids returned from closest_pair_set_insert. */
+    PointSlot* slots;
+    size_t num_slots, slots_capacity, free_slot;
+    /* The number of points in the set. */
+    size_t n;
+    /* The level of the top cells, which are wider than four times any coordinate. */
+    int top_level;
+    /* A hash table from cell levels and coordinates to cells, with linear probing. */
+    GridCell* cells;
+    size_t num_cells, cells_capacity;
+    /* A min heap with the pair of each point and its `best`, and possibly pairs that have since
+     * been replaced or whose points have been removed.
+     */
+    PointPair* heap;
+    size_t heap_len, heap_capacity;
+    /* The number of times the heap has been compacted. */
+    size_t compactions;
+} ClosestPairSet;
+
+
+/* A line that predicts the positions of a range of sorted keys: the key `key` is at `position`,
+ * and each key after it is about `slope` positions further along per unit of key.
+ */
+typedef struct {
+    int key;
+    double slope;
+    size_t position;
+} IndexSegment;
+
+/* An index over a sorted array of keys that predicts the position of a key to within
+ * `max_error` positions. levels[0] holds the segments that predict positions in `keys`, and each
+ * level above it predicts positions in the level below, up to a single segment at the top.
+ */
+typedef struct {
+    const int* keys;
+    size_t n, max_error;
+    size_t num_levels;
+    IndexSegment** levels;
+    size_t* level_lens;
+} LearnedIndex;
+
+
+/* Collects the k smallest elements of a stream. */
+typedef struct {
+    size_t k, len;
+    /* A max heap of the smallest elements seen so far, once `len` reaches `k`. */
+    int* heap;
+} TopK;
+
+
+/* A vertex and its position in a TopologicalOrder. */
+typedef struct {
+    size_t key;
+    size_t vertex;
+} OrderedVertex;
+
+/* A directed acyclic graph that keeps its vertices in topological order as edges are added. */
+typedef struct {
+    /* The edges, and the same edges reversed. */
+    Graph* graph;
+    Graph* reverse;
+    /* order[v] is the position of vertex v, and vertex_at[i] is the vertex at position i. */
+    size_t* order;
+    size_t* vertex_at;
+    /* Scratch space for the searches of topological_order_add_edge. */
+    bool* visited;
+    size_t* stack;
+    OrderedVertex* forward;
+    OrderedVertex* backward;
+    size_t* positions;
+} TopologicalOrder;
+
+
+/* A partition of the integers 0 through n-1 into disjoint sets, which any number of threads can
+ * merge and query at the same time. Each set is a tree, and `parents` holds the parent of each
+ * element, with the root (the smallest element of the set) as its own parent. It is only ever
+ * accessed with atomic operations.
+ */
+typedef struct {
+    size_t n;
+    size_t* parents;
+} DisjointSets;
+
+
 /* Used for depth-first searching a graph. */
 typedef struct {
     size_t len, capacity;
@@ -42,7 +196,10 @@ typedef struct {
 } VertexStack;
 
 
-/* Used for breadth-first searching a graph. */
+/* Used for breadth-first searching a graph. `head` is where the next vertex is pushed and `tail`
+ * is where the next vertex is popped. Both only ever increase, and are reduced to a position in
+ * `data` by masking with capacity - 1, which is always a power of two.
+ */
 typedef struct {
     size_t head, tail, capacity;
     Vertex** data;
@@ -61,9 +218,19 @@ typedef struct {
 enum GraphType { DIRECTED, UNDIRECTED };
 Graph* graph_from_string(enum GraphType, const char* vertices, const char* edges);
 
+/* Construct a graph of `n` unnamed vertices (with `val` set to 0) and no edges. This is meant for
+ * generated graphs that are too large to name each vertex with a single letter.
+ */
+Graph* graph_new(size_t n);
+
 /* Add a directed edge to the graph. */
 void graph_add_edge(Graph* g, char from, char to);
 
+/* Add a directed edge between the vertices at positions `from` and `to` in `g->vertices`. Unlike
+ * graph_add_edge, this is O(1) and does not check whether the edge already exists.
+ */
+void graph_add_edge_index(Graph* g, size_t from, size_t to);
+
 /* Free all memory associated with a graph, including all of its vertices. */
 void graph_free(Graph*);
 
@@ -73,15 +240,33 @@ void vertex_list_free(VertexList* p);
 /* Print the vertices and edges of the graph as strings. */
 void print_graph(const Graph*);
 
+/* Construct an adjacency matrix of `n` unnamed vertices and no edges. */
+GraphMatrix* graph_matrix_new(size_t n);
 
-VertexStack* stack_new(size_t);
+/* Add a directed edge between the vertices at positions `from` and `to`. */
+void graph_matrix_add_edge(GraphMatrix* m, size_t from, size_t to);
+
+/* Convert between adjacency lists and adjacency matrices. Vertex i of one is vertex i of the other,
+ * with the same value. Parallel edges in a Graph become a single edge in the matrix, and the
+ * neighbors of each vertex of a Graph made from a matrix are listed in order of their position.
+ */
+GraphMatrix* graph_matrix_from_graph(const Graph* g);
+Graph* graph_from_matrix(const GraphMatrix* m);
+
+void graph_matrix_free(GraphMatrix*);
+
+
+/* Stacks and queues start with room for at least `n` vertices (rounded up to a power of two), and
+ * double their capacity whenever a push would overflow it.
+ */
+VertexStack* stack_new(size_t n);
 void stack_free(VertexStack*);
 Vertex* stack_pop(VertexStack*);
 void stack_push(VertexStack*, Vertex*);
 bool stack_empty(const VertexStack*);
 
 
-VertexQueue* queue_new(size_t);
+VertexQueue* queue_new(size_t n);
 void queue_free(VertexQueue*);
 Vertex* queue_pop(VertexQueue*);
 void queue_push(VertexQueue*, Vertex*);
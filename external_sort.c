@@ -0,0 +1,610 @@
+/* External merge sort, for sorting files of integers that are too large to fit in memory. */
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "algorithms.h"
+
+
+#define DEFAULT_MEMORY_BUDGET ((size_t)256 * 1024 * 1024)
+/* The smallest block that a run is read in during merging. Smaller blocks mean more runs can be
+ * merged at once, but also more seeks between runs, so below this size it is faster to do another
+ * merge pass instead.
+ */
+#define MIN_BLOCK_SIZE ((size_t)4096)
+
+
+/* A sorted run, stored as a range of bytes in a temporary file. */
+typedef struct {
+    int fd;
+    off_t start, end;
+} Run;
+
+
+/* Read up to `len` bytes at `offset`, retrying on short reads. Return the number of bytes read, or
+ * -1 on error.
+ */
+static ssize_t pread_fully(int fd, void* buffer, size_t len, off_t offset) {
+    size_t total = 0;
+    while (total < len) {
+        ssize_t got = pread(fd, (char*)buffer + total, len - total, offset + total);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        } else if (got == 0) {
+            break;
+        }
+        total += got;
+    }
+    return total;
+}
+
+
+static int pwrite_fully(int fd, const void* buffer, size_t len, off_t offset) {
+    size_t total = 0;
+    while (total < len) {
+        ssize_t put = pwrite(fd, (const char*)buffer + total, len - total, offset + total);
+        if (put < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        total += put;
+    }
+    return 0;
+}
+
+
+/* Create an anonymous temporary file in `dir`. The file is unlinked immediately, so it is cleaned
+ * up by the OS when it is closed, even if the program crashes.
+ */
+static int make_temp_file(const char* dir) {
+    size_t len = strlen(dir) + sizeof "/external_sort_XXXXXX";
+    char* path = safe_malloc(len);
+    snprintf(path, len, "%s/external_sort_XXXXXX", dir);
+    int fd = mkstemp(path);
+    if (fd != -1) {
+        unlink(path);
+    }
+    free(path);
+    return fd;
+}
+
+
+/*************************************
+ *   DOUBLE-BUFFERED OUTPUT WRITER   *
+ *************************************/
+
+/* The merge fills one buffer while a background thread writes the other one out, so that merging
+ * and writing overlap. If the thread cannot be created, each buffer is written out synchronously
+ * instead.
+ */
+typedef struct {
+    int fd;
+    off_t offset;
+    size_t block_size;
+    char* buffers[2];
+    int current;
+    size_t fill;
+
+    bool threaded;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    /* The buffer that the background thread should write next, or NULL if it is idle. */
+    char* pending;
+    size_t pending_len;
+    bool done;
+    int error;
+} BlockWriter;
+
+
+static void* block_writer_thread(void* arg) {
+    BlockWriter* w = arg;
+    pthread_mutex_lock(&w->lock);
+    while (1) {
+        while (w->pending == NULL && !w->done) {
+            pthread_cond_wait(&w->cond, &w->lock);
+        }
+        if (w->pending == NULL) break;
+        char* buffer = w->pending;
+        size_t len = w->pending_len;
+        off_t offset = w->offset;
+        pthread_mutex_unlock(&w->lock);
+        int error = pwrite_fully(w->fd, buffer, len, offset) == -1 ? errno : 0;
+        pthread_mutex_lock(&w->lock);
+        if (error && !w->error) {
+            w->error = error;
+        }
+        w->offset += len;
+        w->pending = NULL;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+
+/* `memory` must hold 2 * `block_size` bytes. */
+static void block_writer_init(BlockWriter* w, int fd, off_t offset, char* memory,
+                              size_t block_size) {
+    w->fd = fd;
+    w->offset = offset;
+    w->block_size = block_size;
+    w->buffers[0] = memory;
+    w->buffers[1] = memory + block_size;
+    w->current = 0;
+    w->fill = 0;
+    w->pending = NULL;
+    w->pending_len = 0;
+    w->done = false;
+    w->error = 0;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    w->threaded = pthread_create(&w->thread, NULL, block_writer_thread, w) == 0;
+}
+
+
+/* Hand the current buffer to the background thread and switch to the other one. */
+static void block_writer_flush(BlockWriter* w) {
+    if (w->fill == 0) return;
+    if (!w->threaded) {
+        if (pwrite_fully(w->fd, w->buffers[w->current], w->fill, w->offset) == -1 && !w->error) {
+            w->error = errno;
+        }
+        w->offset += w->fill;
+        w->fill = 0;
+        return;
+    }
+    pthread_mutex_lock(&w->lock);
+    while (w->pending != NULL) {
+        pthread_cond_wait(&w->cond, &w->lock);
+    }
+    w->pending = w->buffers[w->current];
+    w->pending_len = w->fill;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    w->current = 1 - w->current;
+    w->fill = 0;
+}
+
+
+static void block_writer_put(BlockWriter* w, const char* record, size_t record_size) {
+    memcpy(w->buffers[w->current] + w->fill, record, record_size);
+    w->fill += record_size;
+    if (w->fill + record_size > w->block_size) {
+        block_writer_flush(w);
+    }
+}
+
+
+/* Write out any buffered records and stop the background thread. Return 0 on success or -1 if any
+ * write failed, with errno set.
+ */
+static int block_writer_close(BlockWriter* w) {
+    block_writer_flush(w);
+    if (w->threaded) {
+        pthread_mutex_lock(&w->lock);
+        w->done = true;
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->thread, NULL);
+    }
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+    if (w->error) {
+        errno = w->error;
+        return -1;
+    }
+    return 0;
+}
+
+
+/*********************
+ *   K-WAY MERGING   *
+ *********************/
+
+/* A buffered reader over one run. */
+typedef struct {
+    int fd;
+    off_t next, end;
+    char* block;
+    size_t len, pos;
+} RunReader;
+
+
+/* Read the next block of the run. Return 0 on success (with r->len == 0 at the end of the run) or
+ * -1 on error.
+ */
+static int run_reader_fill(RunReader* r, size_t block_size) {
+    size_t want = r->end - r->next < (off_t)block_size ? (size_t)(r->end - r->next) : block_size;
+    ssize_t got = pread_fully(r->fd, r->block, want, r->next);
+    if (got < 0) return -1;
+    r->next += got;
+    r->len = got;
+    r->pos = 0;
+    /* Ask the kernel to start reading the following block in the background, so that it is
+     * already in the page cache by the time this one has been consumed.
+     */
+    if (r->next < r->end) {
+        posix_fadvise(r->fd, r->next, block_size, POSIX_FADV_WILLNEED);
+    }
+    return 0;
+}
+
+
+static int64_t record_key(const char* record, size_t record_size) {
+    if (record_size == 4) {
+        int32_t v;
+        memcpy(&v, record, sizeof v);
+        return v;
+    } else {
+        int64_t v;
+        memcpy(&v, record, sizeof v);
+        return v;
+    }
+}
+
+
+/* Restore the min-heap invariant for the tournament of run readers, in the same way as fix_heap in
+ * ch06 does for a max heap.
+ */
+static void fix_run_heap(size_t index, size_t heap[], const int64_t keys[], size_t n) {
+    size_t v = heap[index];
+    while (2*index + 1 < n) {
+        size_t j = 2*index + 1;
+        if (j + 1 < n && keys[heap[j+1]] < keys[heap[j]]) {
+            j++;
+        }
+        if (keys[v] <= keys[heap[j]]) {
+            break;
+        }
+        heap[index] = heap[j];
+        index = j;
+    }
+    heap[index] = v;
+}
+
+
+/* Merge the `k` sorted runs into a single sorted run written to `out_fd` at `out_offset`.
+ *
+ *   Idea: Keep the head of each run in a min heap. Repeatedly output the smallest head and replace
+ *   it with the next record from the same run. Each run is read, and the output is written, in
+ *   blocks of `block_size` bytes, so that the disk sees large sequential requests.
+ *
+ *   Time analysis: Each record costs O(log k) comparisons.
+ *
+ *   Space analysis: (k + 2) * block_size bytes, which must be provided in `memory`.
+ */
+static int merge_runs(const Run runs[], size_t k, int out_fd, off_t out_offset,
+                      size_t record_size, size_t block_size, char* memory) {
+    RunReader* readers = safe_malloc(k * sizeof *readers);
+    size_t* heap = safe_malloc(k * sizeof *heap);
+    int64_t* keys = safe_malloc(k * sizeof *keys);
+    int status = 0;
+    size_t heap_len = 0;
+    for (size_t i = 0; i < k; i++) {
+        readers[i].fd = runs[i].fd;
+        readers[i].next = runs[i].start;
+        readers[i].end = runs[i].end;
+        readers[i].block = memory + i * block_size;
+        if (run_reader_fill(&readers[i], block_size) == -1) {
+            status = -1;
+            break;
+        }
+        if (readers[i].len > 0) {
+            keys[i] = record_key(readers[i].block, record_size);
+            heap[heap_len++] = i;
+        }
+    }
+
+    if (status == 0) {
+        BlockWriter writer;
+        block_writer_init(&writer, out_fd, out_offset, memory + k * block_size, block_size);
+        for (size_t i = heap_len / 2; i-- > 0; ) {
+            fix_run_heap(i, heap, keys, heap_len);
+        }
+        while (heap_len > 0) {
+            RunReader* r = &readers[heap[0]];
+            block_writer_put(&writer, r->block + r->pos, record_size);
+            r->pos += record_size;
+            if (r->pos == r->len && run_reader_fill(r, block_size) == -1) {
+                status = -1;
+                break;
+            }
+            if (r->len == 0) {
+                /* The run is exhausted, so remove it from the tournament. */
+                heap[0] = heap[--heap_len];
+            } else {
+                keys[heap[0]] = record_key(r->block + r->pos, record_size);
+            }
+            if (heap_len > 0) {
+                fix_run_heap(0, heap, keys, heap_len);
+            }
+        }
+        if (block_writer_close(&writer) == -1) {
+            status = -1;
+        }
+    }
+
+    free(readers);
+    free(heap);
+    free(keys);
+    return status;
+}
+
+
+/*************************
+ *   EXTERNAL SORTING    *
+ *************************/
+
+static void sort_records(char* records, size_t n, size_t record_size) {
+    if (record_size == 4) {
+        i32_quicksort((int32_t*)records, n);
+    } else {
+        i64_quicksort((int64_t*)records, n);
+    }
+}
+
+
+/* Sort the file at `input_path`, which consists of native-endian signed integers of `record_size`
+ * bytes (4 or 8), in ascending order and write the result to `output_path`. Return 0 on success or
+ * -1 with errno set if an I/O error occurred.
+ *
+ * The result is written to a temporary file next to `output_path`, which is renamed over it only
+ * once the sort has succeeded. The output may therefore be the input file itself, and a failed sort
+ * leaves any existing output untouched.
+ *
+ *   Idea: Read the input in chunks that fit within the memory budget, sort each chunk in memory and
+ *   write it to a temporary file as a sorted "run". Then merge the runs k at a time (see
+ *   merge_runs), where k is as large as the memory budget allows, until only one run is left.
+ *
+ *   Time analysis: O(n log n) comparisons. More importantly for large files, each merge pass reads
+ *   and writes the whole file sequentially once, and the number of passes is about
+ *   log(n / M) / log(M / B) for a memory budget of M bytes and a minimum block size of B, which is
+ *   a single pass for any realistic file and budget.
+ *
+ *   Space analysis: The memory budget, plus O(number of runs) for the bookkeeping. Up to twice the
+ *   size of the input in temporary disk space.
+ */
+int external_sort(const char* input_path, const char* output_path, size_t record_size,
+                  const ExternalSortOptions* options) {
+    if (record_size != 4 && record_size != 8) {
+        errno = EINVAL;
+        return -1;
+    }
+    size_t budget = options != NULL && options->memory_budget > 0
+        ? options->memory_budget : DEFAULT_MEMORY_BUDGET;
+    if (budget < 4 * MIN_BLOCK_SIZE) {
+        budget = 4 * MIN_BLOCK_SIZE;
+    }
+    const char* temp_dir = options != NULL ? options->temp_dir : NULL;
+    if (temp_dir == NULL) temp_dir = getenv("TMPDIR");
+    if (temp_dir == NULL) temp_dir = "/tmp";
+
+    int in_fd = open(input_path, O_RDONLY);
+    if (in_fd == -1) return -1;
+    size_t out_len = strlen(output_path) + sizeof ".XXXXXX";
+    char* temp_output_path = safe_malloc(out_len);
+    snprintf(temp_output_path, out_len, "%s.XXXXXX", output_path);
+    int out_fd = mkstemp(temp_output_path);
+    if (out_fd == -1 || fchmod(out_fd, 0644) == -1) {
+        int error = errno;
+        if (out_fd != -1) {
+            close(out_fd);
+            unlink(temp_output_path);
+        }
+        free(temp_output_path);
+        close(in_fd);
+        errno = error;
+        return -1;
+    }
+    posix_fadvise(in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    char* memory = safe_malloc(budget);
+    size_t runs_len = 0, runs_capacity = 16;
+    Run* runs = safe_malloc(runs_capacity * sizeof *runs);
+    /* Runs are stored in two temporary files, and each merge pass reads from one and writes to the
+     * other.
+     */
+    int temp_fds[2] = { -1, -1 };
+    int status = 0;
+
+    /* Phase 1: create the initial sorted runs. */
+    size_t chunk = budget / record_size * record_size;
+    off_t in_offset = 0, temp_offset = 0;
+    while (1) {
+        ssize_t got = pread_fully(in_fd, memory, chunk, in_offset);
+        if (got < 0 || got % record_size != 0) {
+            if (got >= 0) errno = EINVAL;
+            status = -1;
+            goto cleanup;
+        }
+        if (got == 0) break;
+        in_offset += got;
+        sort_records(memory, got / record_size, record_size);
+        if (in_offset == got && (size_t)got < chunk) {
+            /* The whole input fit in memory, so there is nothing to merge. */
+            status = pwrite_fully(out_fd, memory, got, 0);
+            goto cleanup;
+        }
+        if (temp_fds[0] == -1 && (temp_fds[0] = make_temp_file(temp_dir)) == -1) {
+            status = -1;
+            goto cleanup;
+        }
+        if (pwrite_fully(temp_fds[0], memory, got, temp_offset) == -1) {
+            status = -1;
+            goto cleanup;
+        }
+        if (runs_len == runs_capacity) {
+            runs_capacity *= 2;
+            runs = safe_realloc(runs, runs_capacity * sizeof *runs);
+        }
+        runs[runs_len].fd = temp_fds[0];
+        runs[runs_len].start = temp_offset;
+        runs[runs_len].end = temp_offset + got;
+        runs_len++;
+        temp_offset += got;
+    }
+
+    /* Phase 2: merge the runs, using extra passes if there are too many to merge at once. */
+    size_t fan_in = budget / MIN_BLOCK_SIZE - 2;
+    int source = 0;
+    while (runs_len > fan_in) {
+        int target = 1 - source;
+        if (temp_fds[target] == -1 && (temp_fds[target] = make_temp_file(temp_dir)) == -1) {
+            status = -1;
+            goto cleanup;
+        }
+        size_t block_size = budget / (fan_in + 2) / record_size * record_size;
+        size_t new_len = 0;
+        off_t offset = 0;
+        for (size_t i = 0; i < runs_len; i += fan_in) {
+            size_t k = runs_len - i < fan_in ? runs_len - i : fan_in;
+            if (merge_runs(runs + i, k, temp_fds[target], offset, record_size, block_size,
+                           memory) == -1) {
+                status = -1;
+                goto cleanup;
+            }
+            Run merged = { temp_fds[target], offset, offset + (runs[i+k-1].end - runs[i].start) };
+            offset = merged.end;
+            runs[new_len++] = merged;
+        }
+        runs_len = new_len;
+        source = target;
+    }
+    if (runs_len > 0) {
+        size_t block_size = budget / (runs_len + 2) / record_size * record_size;
+        status = merge_runs(runs, runs_len, out_fd, 0, record_size, block_size, memory);
+    }
+
+cleanup:
+    free(memory);
+    free(runs);
+    for (int i = 0; i < 2; i++) {
+        if (temp_fds[i] != -1) close(temp_fds[i]);
+    }
+    close(in_fd);
+    if (close(out_fd) == -1) status = -1;
+    if (status == 0 && rename(temp_output_path, output_path) == -1) status = -1;
+    if (status == -1) {
+        int error = errno;
+        unlink(temp_output_path);
+        errno = error;
+    }
+    free(temp_output_path);
+    return status;
+}
+
+
+/* Write `n` records to a new temporary file and return its path, which the caller must free. */
+static char* write_test_file(const char* dir, const void* records, size_t n, size_t record_size) {
+    size_t len = strlen(dir) + sizeof "/external_sort_test_XXXXXX";
+    char* path = safe_malloc(len);
+    snprintf(path, len, "%s/external_sort_test_XXXXXX", dir);
+    int fd = mkstemp(path);
+    if (fd != -1) {
+        pwrite_fully(fd, records, n * record_size, 0);
+        close(fd);
+    }
+    return path;
+}
+
+
+/* Return 1 if the file at `path` holds exactly the `n` records of `records` (of `record_size`
+ * bytes each) in ascending order, as sorted in memory, and 0 otherwise. `records` is sorted in
+ * place.
+ */
+static int file_is_sorted(const char* path, void* records, size_t n, size_t record_size) {
+    sort_records(records, n, record_size);
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return 0;
+    char* data = safe_malloc(n * record_size + 1);
+    ssize_t got = pread_fully(fd, data, n * record_size + 1, 0);
+    close(fd);
+    int ok = got == (ssize_t)(n * record_size)
+             && (n == 0 || memcmp(data, records, n * record_size) == 0);
+    free(data);
+    return ok;
+}
+
+
+int external_sort_tests() {
+    puts("\n=== EXTERNAL SORTING TESTS ===");
+    int tests_failed = 0;
+    const char* dir = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+
+    /* 32-BIT RECORDS */
+    puts("Testing external sort of 32-bit records");
+    size_t n32 = 100000;
+    int32_t* data32 = safe_malloc(n32 * sizeof *data32);
+    for (size_t i = 0; i < n32; i++) {
+        data32[i] = (int32_t)((i * 2654435761u) % 1000003) - 500000;
+    }
+    char* in_path = write_test_file(dir, data32, n32, 4);
+    char* out_path = write_test_file(dir, NULL, 0, 4);
+    /* A 16 KiB budget makes 25 runs but can only merge 2 at a time, so this exercises several
+     * merge passes.
+     */
+    ExternalSortOptions options = { 16 * 1024, dir };
+    ASSERT(external_sort(in_path, out_path, 4, &options) == 0);
+    ASSERT(file_is_sorted(out_path, data32, n32, 4));
+    /* With the default budget, the input is sorted in memory. */
+    ASSERT(external_sort(in_path, out_path, 4, NULL) == 0);
+    ASSERT(file_is_sorted(out_path, data32, n32, 4));
+    unlink(in_path);
+    free(in_path);
+
+    /* Sorting a file onto itself, both through several merge passes and in memory. */
+    puts("Testing external sort in place");
+    for (size_t i = 0; i < n32; i++) {
+        data32[i] = (int32_t)((i * 40503u) % 65537) - 30000;
+    }
+    in_path = write_test_file(dir, data32, n32, 4);
+    ASSERT(external_sort(in_path, in_path, 4, &options) == 0);
+    ASSERT(file_is_sorted(in_path, data32, n32, 4));
+    unlink(in_path);
+    free(in_path);
+    for (size_t i = 0; i < n32; i++) {
+        data32[i] = (int32_t)(n32 - i);
+    }
+    in_path = write_test_file(dir, data32, n32, 4);
+    ASSERT(external_sort(in_path, in_path, 4, NULL) == 0);
+    ASSERT(file_is_sorted(in_path, data32, n32, 4));
+    /* A failed sort leaves the existing output alone. */
+    ASSERT(external_sort(in_path, in_path, 3, NULL) == -1);
+    ASSERT(file_is_sorted(in_path, data32, n32, 4));
+    unlink(in_path);
+    free(in_path);
+    free(data32);
+
+    /* 64-BIT RECORDS */
+    puts("Testing external sort of 64-bit records");
+    size_t n64 = 50000;
+    int64_t* data64 = safe_malloc(n64 * sizeof *data64);
+    for (size_t i = 0; i < n64; i++) {
+        data64[i] = (int64_t)(i % 7) * 4000000000LL - (int64_t)i;
+    }
+    in_path = write_test_file(dir, data64, n64, 8);
+    options.memory_budget = 64 * 1024;
+    ASSERT(external_sort(in_path, out_path, 8, &options) == 0);
+    ASSERT(file_is_sorted(out_path, data64, n64, 8));
+    ASSERT(external_sort(in_path, out_path, 3, &options) == -1);
+    unlink(in_path);
+    free(in_path);
+    free(data64);
+
+    /* EMPTY INPUT */
+    in_path = write_test_file(dir, NULL, 0, 4);
+    ASSERT(external_sort(in_path, out_path, 4, &options) == 0);
+    ASSERT(file_is_sorted(out_path, NULL, 0, 4));
+    unlink(in_path);
+    free(in_path);
+
+    unlink(out_path);
+    free(out_path);
+    return tests_failed;
+}
@@ -0,0 +1,81 @@
+#include <stdlib.h>
+#include "algorithms.h"
+
+
+SORTING_DEFINE(i32, int32_t, LESS_THAN)
+SORTING_DEFINE(i64, int64_t, LESS_THAN)
+SORTING_DEFINE(u64, uint64_t, LESS_THAN)
+SORTING_DEFINE(f32, float, LESS_THAN_FLOAT)
+SORTING_DEFINE(f64, double, LESS_THAN_FLOAT)
+SORTING_DEFINE(kv, KeyValue, LESS_THAN_KEY)
+
+
+typedef void i64_sorting_f(int64_t*, size_t);
+
+/* Run each sort on the same kinds of inputs as test_sorting_f, plus a larger array with duplicates
+ * that exercises quicksort's partitioning and merge sort's recursion.
+ */
+static int test_i64_sorting_f(i64_sorting_f f) {
+    int64_t data[] = {-8, 99, 7, 8, 9, -2, 0, 1, 4, 59, 42, 10, INT64_MIN, INT64_MAX};
+    size_t n = sizeof data / sizeof data[0];
+    f(data, n);
+    for (size_t i = 0; i + 1 < n; i++) {
+        if (data[i] > data[i+1]) return 1;
+    }
+    int64_t big[1000];
+    for (size_t i = 0; i < 1000; i++) {
+        big[i] = (int64_t)((i * 7919) % 211) - 100;
+    }
+    f(big, 1000);
+    for (size_t i = 0; i + 1 < 1000; i++) {
+        if (big[i] > big[i+1]) return 1;
+    }
+    return 0;
+}
+
+
+int generic_sort_tests() {
+    puts("\n=== TYPE-GENERIC SORTING and SEARCHING TESTS ===");
+    int tests_failed = 0;
+
+    /* 64-BIT INTEGERS */
+    puts("Testing 64-bit integer sorts");
+    ASSERT(test_i64_sorting_f(i64_insertion_sort) == 0);
+    ASSERT(test_i64_sorting_f(i64_quicksort) == 0);
+    ASSERT(test_i64_sorting_f(i64_merge_sort) == 0);
+    ASSERT(test_i64_sorting_f(i64_heapsort) == 0);
+
+    puts("Testing 64-bit integer searches");
+    int64_t search_data[] = {-7, 4, 4, 9, 5000000000LL};
+    ASSERT(i64_binary_search(search_data, 5, -7) == 0);
+    ASSERT(i64_binary_search(search_data, 5, 4) == 1);
+    ASSERT(i64_binary_search(search_data, 5, 5000000000LL) == 4);
+    ASSERT(i64_binary_search(search_data, 5, 8) == -1);
+    ASSERT(i64_linear_search(search_data, 5, 9) == 3);
+    ASSERT(i64_linear_search(search_data, 5, 10) == -1);
+
+    /* FLOATING POINT */
+    puts("Testing floating-point sorts with NaN");
+    double doubles[] = {2.5, NAN, -1.0, INFINITY, 0.0, NAN, -INFINITY};
+    f64_quicksort(doubles, 7);
+    ASSERT(doubles[0] == -INFINITY && doubles[1] == -1.0 && doubles[2] == 0.0);
+    ASSERT(doubles[3] == 2.5 && doubles[4] == INFINITY);
+    ASSERT(isnan(doubles[5]) && isnan(doubles[6]));
+    ASSERT(f64_binary_search(doubles, 7, 2.5) == 3);
+    ASSERT(f64_binary_search(doubles, 7, NAN) == 5);
+    float floats[] = {3.0f, NAN, 1.0f, 2.0f};
+    f32_merge_sort(floats, 4);
+    ASSERT(floats[0] == 1.0f && floats[1] == 2.0f && floats[2] == 3.0f && isnan(floats[3]));
+
+    /* KEY-PAYLOAD RECORDS */
+    puts("Testing key-payload record sorts");
+    KeyValue records[] = { {3, 0}, {1, 1}, {3, 2}, {2, 3}, {1, 4} };
+    kv_merge_sort(records, 5);
+    /* Merge sort is stable, so records with equal keys stay in their original order. */
+    ASSERT(records[0].payload == 1 && records[1].payload == 4 && records[2].payload == 3);
+    ASSERT(records[3].payload == 0 && records[4].payload == 2);
+    KeyValue needle = {2, -1};
+    ASSERT(kv_binary_search(records, 5, needle) == 2);
+
+    return tests_failed;
+}
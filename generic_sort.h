@@ -0,0 +1,234 @@
+#pragma once
+
+/* Type-generic versions of the sorting and searching algorithms.
+ *
+ * The algorithms in algorithms.h only work on arrays of `int`, and the C standard library's qsort
+ * works on any type but pays for an indirect function call on every comparison. The macros in this
+ * file instead generate a complete copy of each algorithm for a given element type and comparison,
+ * so that the comparison is inlined into the generated code.
+ *
+ * SORTING_DECLARE(prefix, type) declares the following functions, and
+ * SORTING_DEFINE(prefix, type, less) defines them, where `less(a, b)` is the name of a macro (or
+ * function) that returns true if `a` should be sorted before `b`:
+ *
+ *   void prefix_insertion_sort(type array[], size_t n);
+ *   void prefix_quicksort(type array[], size_t n);
+ *   void prefix_merge_sort(type array[], size_t n);
+ *   void prefix_heapsort(type array[], size_t n);
+ *   void prefix_merge(const type left[], size_t left_len, const type right[], size_t right_len,
+ *                     type target[]);
+ *   long long prefix_binary_search(const type array[], size_t n, type datum);
+ *   long long prefix_linear_search(const type array[], size_t n, type datum);
+ *
+ * Two elements are considered equal by the searches if neither is less than the other.
+ * SORTING_DEFINE_STATIC defines the same functions as `static inline`, for instantiations that are
+ * private to a single source file.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* The same declaration as in algorithms.h, so that this header can be included on its own. */
+void* safe_malloc(size_t);
+
+
+/* Comparisons for use with SORTING_DEFINE. */
+#define LESS_THAN(a, b) ((a) < (b))
+/* A total order on floating-point numbers where NaN compares equal to itself and greater than every
+ * other number, so that NaNs are sorted to the end of the array instead of scrambling it.
+ */
+#define LESS_THAN_FLOAT(a, b) (!isnan(a) && (isnan(b) || (a) < (b)))
+/* Compare structs by their `key` field. */
+#define LESS_THAN_KEY(a, b) ((a).key < (b).key)
+
+
+/* Subarrays of this size or smaller are insertion sorted by quicksort and merge sort. */
+#define GENERIC_SORT_CUTOFF 16
+
+
+#define SORTING_DECLARE(prefix, type) \
+    void prefix##_insertion_sort(type array[], size_t n); \
+    void prefix##_quicksort(type array[], size_t n); \
+    void prefix##_merge_sort(type array[], size_t n); \
+    void prefix##_heapsort(type array[], size_t n); \
+    void prefix##_merge(const type left[], size_t left_len, const type right[], size_t right_len, \
+                        type target[]); \
+    long long prefix##_binary_search(const type array[], size_t n, type datum); \
+    long long prefix##_linear_search(const type array[], size_t n, type datum);
+
+#define SORTING_DEFINE(prefix, type, less) SORTING_DEFINE_WITH_LINKAGE(, prefix, type, less)
+#define SORTING_DEFINE_STATIC(prefix, type, less) \
+    SORTING_DEFINE_WITH_LINKAGE(static inline, prefix, type, less)
+
+
+#define SORTING_DEFINE_WITH_LINKAGE(linkage, prefix, type, less) \
+    \
+    /* The same algorithm as insertion_sort in ch04. */ \
+    linkage void prefix##_insertion_sort(type array[], size_t n) { \
+        for (size_t i = 1; i < n; i++) { \
+            type v = array[i]; \
+            size_t j = i; \
+            while (j > 0 && less(v, array[j-1])) { \
+                array[j] = array[j-1]; \
+                j--; \
+            } \
+            array[j] = v; \
+        } \
+    } \
+    \
+    /* The same algorithm as fix_heap in ch06. */ \
+    static inline void prefix##_fix_heap(size_t index, type heap[], size_t n) { \
+        type v = heap[index]; \
+        while (2*index + 1 < n) { \
+            size_t j = 2*index + 1; \
+            if (j + 1 < n && less(heap[j], heap[j+1])) { \
+                j++; \
+            } \
+            if (!less(v, heap[j])) { \
+                break; \
+            } \
+            heap[index] = heap[j]; \
+            index = j; \
+        } \
+        heap[index] = v; \
+    } \
+    \
+    /* The same algorithm as heapsort in ch06. */ \
+    linkage void prefix##_heapsort(type array[], size_t n) { \
+        if (n < 2) return; \
+        for (size_t i = n/2; i-- > 0; ) { \
+            prefix##_fix_heap(i, array, n); \
+        } \
+        while (n > 1) { \
+            type tmp = array[0]; \
+            array[0] = array[n-1]; \
+            array[n-1] = tmp; \
+            prefix##_fix_heap(0, array, --n); \
+        } \
+    } \
+    \
+    /* Quicksort as in ch05, but with a median-of-three pivot, an insertion sort for small \
+     * subarrays, and a fallback to heapsort if the recursion gets too deep (i.e., introsort), so \
+     * that the worst case is O(n log n) time and O(log n) space. \
+     */ \
+    static inline void prefix##_quicksort_helper(type array[], size_t n, int depth) { \
+        while (n > GENERIC_SORT_CUTOFF) { \
+            if (depth-- == 0) { \
+                prefix##_heapsort(array, n); \
+                return; \
+            } \
+            /* Sort the first, middle and last elements, and use the middle one as the pivot. */ \
+            size_t mid = n / 2; \
+            type tmp; \
+            if (less(array[mid], array[0])) { \
+                tmp = array[mid]; array[mid] = array[0]; array[0] = tmp; \
+            } \
+            if (less(array[n-1], array[mid])) { \
+                tmp = array[n-1]; array[n-1] = array[mid]; array[mid] = tmp; \
+                if (less(array[mid], array[0])) { \
+                    tmp = array[mid]; array[mid] = array[0]; array[0] = tmp; \
+                } \
+            } \
+            type pivot = array[mid]; \
+            /* Hoare partition, as in ch05. */ \
+            size_t i = 0, j = n - 1; \
+            while (1) { \
+                while (less(array[i], pivot)) i++; \
+                while (less(pivot, array[j])) j--; \
+                if (i >= j) break; \
+                tmp = array[i]; array[i] = array[j]; array[j] = tmp; \
+                i++; \
+                j--; \
+            } \
+            /* Recurse on the smaller partition and loop on the larger one. */ \
+            size_t left_n = j + 1; \
+            if (left_n < n - left_n) { \
+                prefix##_quicksort_helper(array, left_n, depth); \
+                array += left_n; \
+                n -= left_n; \
+            } else { \
+                prefix##_quicksort_helper(array + left_n, n - left_n, depth); \
+                n = left_n; \
+            } \
+        } \
+        prefix##_insertion_sort(array, n); \
+    } \
+    \
+    linkage void prefix##_quicksort(type array[], size_t n) { \
+        int depth = 0; \
+        for (size_t m = n; m > 1; m /= 2) { \
+            depth += 2; \
+        } \
+        prefix##_quicksort_helper(array, n, depth); \
+    } \
+    \
+    /* The same algorithm as merge in ch05. Equal elements are taken from `left` first, so merge \
+     * sort is stable. \
+     */ \
+    linkage void prefix##_merge(const type left[], size_t left_len, const type right[], \
+                                size_t right_len, type target[]) { \
+        size_t i = 0, j = 0, k = 0; \
+        while (i < left_len && j < right_len) { \
+            if (less(right[j], left[i])) { \
+                target[k++] = right[j++]; \
+            } else { \
+                target[k++] = left[i++]; \
+            } \
+        } \
+        while (i < left_len) target[k++] = left[i++]; \
+        while (j < right_len) target[k++] = right[j++]; \
+    } \
+    \
+    /* Sort `array` using `scratch`, which has the same length, as the merge buffer. */ \
+    static inline void prefix##_merge_sort_helper(type array[], type scratch[], size_t n) { \
+        if (n <= GENERIC_SORT_CUTOFF) { \
+            prefix##_insertion_sort(array, n); \
+            return; \
+        } \
+        size_t left_n = n / 2; \
+        prefix##_merge_sort_helper(array, scratch, left_n); \
+        prefix##_merge_sort_helper(array + left_n, scratch + left_n, n - left_n); \
+        prefix##_merge(array, left_n, array + left_n, n - left_n, scratch); \
+        for (size_t i = 0; i < n; i++) { \
+            array[i] = scratch[i]; \
+        } \
+    } \
+    \
+    /* Merge sort as in ch05, but with a single scratch buffer allocated up front instead of a \
+     * pair of copies at every level of the recursion. \
+     */ \
+    linkage void prefix##_merge_sort(type array[], size_t n) { \
+        if (n < 2) return; \
+        type* scratch = safe_malloc(n * sizeof *scratch); \
+        prefix##_merge_sort_helper(array, scratch, n); \
+        free(scratch); \
+    } \
+    \
+    /* Return the first position of `datum` in the sorted array, or -1 if `datum` is not present. */ \
+    linkage long long prefix##_binary_search(const type array[], size_t n, type datum) { \
+        size_t start = 0, end = n; \
+        while (start < end) { \
+            size_t mid = start + (end - start) / 2; \
+            if (less(array[mid], datum)) { \
+                start = mid + 1; \
+            } else { \
+                end = mid; \
+            } \
+        } \
+        if (start < n && !less(datum, array[start])) { \
+            return start; \
+        } \
+        return -1; \
+    } \
+    \
+    linkage long long prefix##_linear_search(const type array[], size_t n, type datum) { \
+        for (size_t i = 0; i < n; i++) { \
+            if (!less(array[i], datum) && !less(datum, array[i])) { \
+                return i; \
+            } \
+        } \
+        return -1; \
+    }
@@ -9,6 +9,12 @@ int main(int argc, char* argv[]) {
     tests_failed += ch04_tests();
     tests_failed += ch05_tests();
     tests_failed += ch06_tests();
+    tests_failed += ch07_tests();
+    tests_failed += ch08_tests();
+    tests_failed += ch09_tests();
+    tests_failed += generic_sort_tests();
+    tests_failed += external_sort_tests();
+    tests_failed += sorting_network_tests();
     if (tests_failed > 0) {
         printf("\nFAILED %d test%s.\n", tests_failed, tests_failed == 1 ? "" : "s");
     } else {
@@ -0,0 +1,383 @@
+/* Sorting networks for small arrays, used as the base case of the divide-and-conquer sorts.
+ *
+ * A sorting network is a fixed sequence of compare-exchange operations that sorts any input of a
+ * given size. Since the sequence does not depend on the data, it has no unpredictable branches,
+ * and many compare-exchanges can be done at once with SIMD min/max instructions. The same building
+ * blocks also give a SIMD kernel for merging two sorted arrays (merge_avx2).
+ */
+#include <limits.h>
+#include "algorithms.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_KERNELS 1
+#include <immintrin.h>
+#endif
+
+
+/* Sort array[0...n-1] in ascending order, for n <= SMALL_SORT_MAX.
+ *
+ *   Idea: Bitonic sort. Pad the array with INT_MAX up to a power of two, p. For k = 2, 4, ..., p,
+ *   sort blocks of size k alternately ascending and descending, by merging pairs of sorted blocks
+ *   of size k/2 (which, one ascending and one descending, form a "bitonic" sequence): compare-
+ *   exchange elements at distance k/2, then k/4, ..., then 1. Each compare-exchange is written
+ *   with a conditional expression that compiles to a branchless conditional move.
+ *
+ *   Time analysis: p/2 * log p * (log p + 1) / 2 compare-exchanges, so O(n log^2 n), but with no
+ *   branch mispredictions.
+ *
+ *   Space analysis: O(p), on the stack.
+ */
+void sorting_network_scalar(int array[], size_t n) {
+    if (n < 2) return;
+    int x[SMALL_SORT_MAX];
+    size_t p = 2;
+    while (p < n) {
+        p *= 2;
+    }
+    for (size_t i = 0; i < p; i++) {
+        x[i] = i < n ? array[i] : INT_MAX;
+    }
+    for (size_t k = 2; k <= p; k *= 2) {
+        for (size_t j = k / 2; j > 0; j /= 2) {
+            for (size_t i = 0; i < p; i++) {
+                size_t l = i ^ j;
+                if (l > i) {
+                    int a = x[i], b = x[l];
+                    int lo = a < b ? a : b;
+                    int hi = a < b ? b : a;
+                    /* Blocks with the k bit set are sorted in descending order. */
+                    bool ascending = (i & k) == 0;
+                    x[i] = ascending ? lo : hi;
+                    x[l] = ascending ? hi : lo;
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        array[i] = x[i];
+    }
+}
+
+
+#ifdef HAVE_AVX2_KERNELS
+
+#define AVX2 __attribute__((target("avx2")))
+
+/* One layer of a bitonic network inside a single register of 8 ints: compare each lane with the
+ * lane at distance j (its partner, lane ^ j), and keep the larger value in the lanes whose bit is
+ * set in `max_mask`. The mask has to be a compile-time constant for the blend instruction.
+ */
+#define AVX2_LAYER(v, j, max_mask) do { \
+        __m256i partner = _mm256_permutevar8x32_epi32((v), _mm256_setr_epi32( \
+            0 ^ (j), 1 ^ (j), 2 ^ (j), 3 ^ (j), 4 ^ (j), 5 ^ (j), 6 ^ (j), 7 ^ (j))); \
+        (v) = _mm256_blend_epi32(_mm256_min_epi32((v), partner), \
+                                 _mm256_max_epi32((v), partner), (max_mask)); \
+    } while (0)
+
+
+/* Sort the 8 lanes of a register in ascending order, with the 6 layers of a bitonic sort. In each
+ * layer, lane i takes the maximum if ((i & j) != 0) != ((i & k) != 0), i.e. if it is the upper lane
+ * of an ascending pair or the lower lane of a descending one.
+ */
+static inline AVX2 __m256i avx2_sort8(__m256i v) {
+    AVX2_LAYER(v, 1, 0x66);  /* k = 2 */
+    AVX2_LAYER(v, 2, 0x3c);  /* k = 4 */
+    AVX2_LAYER(v, 1, 0x5a);
+    AVX2_LAYER(v, 4, 0xf0);  /* k = 8 */
+    AVX2_LAYER(v, 2, 0xcc);
+    AVX2_LAYER(v, 1, 0xaa);
+    return v;
+}
+
+
+/* Sort the 8 lanes of a register that hold a bitonic sequence, with the last 3 layers of the
+ * network.
+ */
+static inline AVX2 __m256i avx2_bitonic_clean8(__m256i v) {
+    AVX2_LAYER(v, 4, 0xf0);
+    AVX2_LAYER(v, 2, 0xcc);
+    AVX2_LAYER(v, 1, 0xaa);
+    return v;
+}
+
+
+static inline AVX2 __m256i avx2_reverse8(__m256i v) {
+    return _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+}
+
+
+/* The same bitonic sort as sorting_network_scalar, 8 lanes at a time.
+ *
+ *   Idea: Load the array into r = 1, 2, 4 or 8 registers (padded with INT_MAX), and sort each
+ *   register in place. Then repeatedly merge pairs of sorted sequences of w registers: reverse the
+ *   second one (both the order of the registers and the lanes in each), which makes the pair a
+ *   bitonic sequence, compare-exchange whole registers at distance w, w/2, ..., 1, and finish by
+ *   cleaning up each register internally.
+ *
+ *   Time analysis: The same number of compare-exchanges as the scalar network, but 8 of them per
+ *   min/max instruction, and without touching memory between the load and the store.
+ *
+ *   Space analysis: O(1).
+ */
+AVX2 void sorting_network_avx2(int array[], size_t n) {
+    if (n < 2) return;
+    __m256i v[SMALL_SORT_MAX / 8];
+    size_t r = 1;
+    while (8*r < n) {
+        r *= 2;
+    }
+    int buffer[SMALL_SORT_MAX];
+    for (size_t i = 0; i < 8*r; i++) {
+        buffer[i] = i < n ? array[i] : INT_MAX;
+    }
+    for (size_t i = 0; i < r; i++) {
+        v[i] = avx2_sort8(_mm256_loadu_si256((const __m256i*)(buffer + 8*i)));
+    }
+    for (size_t w = 1; w < r; w *= 2) {
+        for (size_t g = 0; g < r; g += 2*w) {
+            /* Reverse the second sorted sequence of the pair. */
+            for (size_t t = 0; t < w / 2; t++) {
+                __m256i tmp = v[g + w + t];
+                v[g + w + t] = v[g + 2*w - 1 - t];
+                v[g + 2*w - 1 - t] = tmp;
+            }
+            for (size_t t = 0; t < w; t++) {
+                v[g + w + t] = avx2_reverse8(v[g + w + t]);
+            }
+            /* Half-cleaners across registers. */
+            for (size_t d = w; d > 0; d /= 2) {
+                for (size_t i = g; i < g + 2*w; i++) {
+                    if (((i - g) & d) == 0) {
+                        __m256i lo = _mm256_min_epi32(v[i], v[i + d]);
+                        v[i + d] = _mm256_max_epi32(v[i], v[i + d]);
+                        v[i] = lo;
+                    }
+                }
+            }
+            for (size_t i = g; i < g + 2*w; i++) {
+                v[i] = avx2_bitonic_clean8(v[i]);
+            }
+        }
+    }
+    for (size_t i = 0; i < r; i++) {
+        _mm256_storeu_si256((__m256i*)(buffer + 8*i), v[i]);
+    }
+    for (size_t i = 0; i < n; i++) {
+        array[i] = buffer[i];
+    }
+    /* Leave the upper halves of the registers clean: code built without optimization does not
+     * insert vzeroupper, and SSE code that runs next would pay for the dirty state on every
+     * instruction.
+     */
+    _mm256_zeroupper();
+}
+
+
+/* Merge the sorted registers a and b, so that a holds the 8 smallest of their 16 lanes and b holds
+ * the 8 largest, both in ascending order.
+ */
+static inline AVX2 void avx2_merge8x8(__m256i* a, __m256i* b) {
+    __m256i reversed = avx2_reverse8(*b);
+    __m256i lo = _mm256_min_epi32(*a, reversed);
+    __m256i hi = _mm256_max_epi32(*a, reversed);
+    *a = avx2_bitonic_clean8(lo);
+    *b = avx2_bitonic_clean8(hi);
+}
+
+
+/* Load the next 8 elements of `array` starting at *index, padding with INT_MAX past `len`. */
+static inline AVX2 __m256i avx2_load_padded(const int array[], size_t len, size_t* index) {
+    size_t i = *index;
+    *index += 8;
+    if (i + 8 <= len) {
+        return _mm256_loadu_si256((const __m256i*)(array + i));
+    }
+    int buffer[8];
+    for (size_t t = 0; t < 8; t++) {
+        buffer[t] = i + t < len ? array[i + t] : INT_MAX;
+    }
+    return _mm256_loadu_si256((const __m256i*)buffer);
+}
+
+
+/* The same as merge, 8 elements at a time.
+ *
+ *   Idea: Keep the 8 largest elements merged so far in a register, `high`. Load the next 8
+ *   elements from whichever array has the smaller next element, and merge them with `high` using a
+ *   bitonic merge network (avx2_merge8x8). The lower 8 lanes of the result are the next 8 elements
+ *   of the output, and the upper 8 become the new `high`. Choosing the array with the smaller next
+ *   element guarantees that no element still in either array is smaller than the lower half. The
+ *   arrays are treated as if they were padded with INT_MAX, and only the first
+ *   left_len + right_len elements of the output are stored.
+ *
+ *   Time analysis: O(left_len + right_len), with one (unpredictable) branch per 8 elements instead
+ *   of one per element.
+ *
+ *   Space analysis: O(1).
+ */
+AVX2 void merge_avx2(int left[], size_t left_len, int right[], size_t right_len, int target[]) {
+    size_t total = left_len + right_len;
+    if (left_len == 0 || right_len == 0) {
+        merge_branchless(left, left_len, right, right_len, target);
+        return;
+    }
+    size_t i = 0, j = 0, k = 0;
+    __m256i low = avx2_load_padded(left, left_len, &i);
+    __m256i high = avx2_load_padded(right, right_len, &j);
+    while (1) {
+        avx2_merge8x8(&low, &high);
+        if (k + 8 <= total) {
+            _mm256_storeu_si256((__m256i*)(target + k), low);
+            k += 8;
+        } else {
+            int buffer[8];
+            _mm256_storeu_si256((__m256i*)buffer, low);
+            for (size_t t = 0; k < total; t++) {
+                target[k++] = buffer[t];
+            }
+        }
+        if (i >= left_len && j >= right_len) break;
+        if (j >= right_len || (i < left_len && left[i] <= right[j])) {
+            low = avx2_load_padded(left, left_len, &i);
+        } else {
+            low = avx2_load_padded(right, right_len, &j);
+        }
+    }
+    int buffer[8];
+    _mm256_storeu_si256((__m256i*)buffer, high);
+    for (size_t t = 0; k < total; t++) {
+        target[k++] = buffer[t];
+    }
+    /* As in sorting_network_avx2. */
+    _mm256_zeroupper();
+}
+
+
+bool have_avx2(void) {
+    /* Sorts may run on several threads at once. Every thread computes the same answer, so it is
+     * enough for the cached value to be read and written atomically.
+     */
+    static int supported = -1;
+    int cached = __atomic_load_n(&supported, __ATOMIC_RELAXED);
+    if (cached == -1) {
+        __builtin_cpu_init();
+        cached = __builtin_cpu_supports("avx2") != 0;
+        __atomic_store_n(&supported, cached, __ATOMIC_RELAXED);
+    }
+    return cached;
+}
+
+#else
+
+void sorting_network_avx2(int array[], size_t n) {
+    sorting_network_scalar(array, n);
+}
+
+
+void merge_avx2(int left[], size_t left_len, int right[], size_t right_len, int target[]) {
+    merge_branchless(left, left_len, right, right_len, target);
+}
+
+
+bool have_avx2(void) {
+    return false;
+}
+
+#endif
+
+
+/* Sort array[0...n-1] in ascending order, for n <= SMALL_SORT_MAX, with the fastest sorting network
+ * that this CPU supports.
+ */
+void small_sort(int array[], size_t n) {
+    if (have_avx2()) {
+        sorting_network_avx2(array, n);
+    } else {
+        sorting_network_scalar(array, n);
+    }
+}
+
+
+typedef void small_sorting_f(int*, size_t);
+
+/* Return 0 if `f` correctly sorts arrays of every size up to SMALL_SORT_MAX, 1 otherwise. */
+static int test_small_sorting_f(small_sorting_f f) {
+    int data[SMALL_SORT_MAX], expected[SMALL_SORT_MAX];
+    unsigned int seed = 12345;
+    for (size_t n = 0; n <= SMALL_SORT_MAX; n++) {
+        for (int trial = 0; trial < 20; trial++) {
+            for (size_t i = 0; i < n; i++) {
+                seed = seed * 1103515245 + 12345;
+                /* Include duplicates and the extreme values, which collide with the padding. */
+                int x = (int)(seed >> 16) % (trial % 2 ? 8 : 100000) - 4;
+                data[i] = expected[i] = trial == 3 && i % 3 == 0 ? INT_MAX
+                                      : trial == 5 && i % 3 == 0 ? INT_MIN : x;
+            }
+            f(data, n);
+            i32_insertion_sort(expected, n);
+            for (size_t i = 0; i < n; i++) {
+                if (data[i] != expected[i]) return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+
+typedef void merging_f(int*, size_t, int*, size_t, int*);
+
+/* Return 0 if `f` correctly merges sorted arrays of every pair of lengths up to 40, 1 otherwise. */
+static int test_merging_f(merging_f f) {
+    int left[40], right[40], target[80], expected[80];
+    unsigned int seed = 6789;
+    for (size_t left_len = 0; left_len <= 40; left_len++) {
+        for (size_t right_len = 0; right_len <= 40; right_len++) {
+            for (size_t i = 0; i < left_len + right_len; i++) {
+                seed = seed * 1103515245 + 12345;
+                int x = (int)(seed >> 16) % 50;
+                expected[i] = i % 11 == 0 ? INT_MAX : x;
+            }
+            for (size_t i = 0; i < left_len + right_len; i++) {
+                if (i < left_len) {
+                    left[i] = expected[i];
+                } else {
+                    right[i - left_len] = expected[i];
+                }
+            }
+            i32_insertion_sort(left, left_len);
+            i32_insertion_sort(right, right_len);
+            i32_insertion_sort(expected, left_len + right_len);
+            f(left, left_len, right, right_len, target);
+            for (size_t i = 0; i < left_len + right_len; i++) {
+                if (target[i] != expected[i]) return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+
+int sorting_network_tests() {
+    puts("\n=== SORTING NETWORK TESTS ===");
+    int tests_failed = 0;
+
+    puts("Testing scalar sorting network");
+    ASSERT(test_small_sorting_f(sorting_network_scalar) == 0);
+
+    if (have_avx2()) {
+        puts("Testing AVX2 sorting network");
+        ASSERT(test_small_sorting_f(sorting_network_avx2) == 0);
+    } else {
+        puts("Skipping AVX2 sorting network (not supported by this CPU)");
+    }
+
+    puts("Testing branchless merge");
+    ASSERT(test_merging_f(merge_branchless) == 0);
+
+    if (have_avx2()) {
+        puts("Testing AVX2 merge");
+        ASSERT(test_merging_f(merge_avx2) == 0);
+    }
+
+    return tests_failed;
+}
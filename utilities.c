@@ -1,4 +1,6 @@
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "algorithms.h"
@@ -96,3 +98,31 @@ int array_eq(size_t n, int array[], ...) {
     }
     return 1;
 }
+
+
+/* Run `task` on each of the `num_tasks` elements of the array `tasks` (each `size` bytes long), on
+ * one thread per element. The first element is run on the calling thread, as is any element whose
+ * thread cannot be created.
+ */
+void run_in_parallel(void* (*task)(void*), void* tasks, size_t size, int num_tasks) {
+    if (num_tasks == 1) {
+        task(tasks);
+        return;
+    }
+    pthread_t* threads = safe_malloc(num_tasks * sizeof *threads);
+    bool* started = safe_calloc(num_tasks, sizeof *started);
+    for (int i = 1; i < num_tasks; i++) {
+        started[i] = pthread_create(&threads[i], NULL, task, (char*)tasks + i*size) == 0;
+        if (!started[i]) {
+            task((char*)tasks + i*size);
+        }
+    }
+    task(tasks);
+    for (int i = 1; i < num_tasks; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    free(threads);
+    free(started);
+}